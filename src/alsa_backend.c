@@ -22,277 +22,1659 @@
 //##############################################################################
 
 #include <alsa/asoundlib.h>
+#include <alsa/mixer_abst.h>
 
 #include <glib.h>
-#include <gtk/gtk.h>
-#include <math.h>
 
 #include "alsa_backend.h"
 #include "alsa_volume_mapping.h"
 #include "config.h"
 
+//##############################################################################
+// Definitions
+//##############################################################################
+#define CARD_PROBE_THREADS 4
+
+// Number of slots in the queues between the main loop and the mixer thread
+#define QUEUE_SIZE 64
+
+// Milliseconds close waits for the queued writes before giving up on them
+#define CLOSE_TIMEOUT 500
+
+// Milliseconds a mixer call may block before the session is abandoned
+#define STALL_THRESHOLD 3000
+
+// Seconds between the checks for a blocked mixer call
+#define WATCHDOG_INTERVAL 1
+
+// Poll dispatches per second above which the mixer thread is spinning
+#define SPIN_THRESHOLD 500
+
+// First and longest delay in milliseconds before a lost session is started
+// again, the delay doubles after every failed attempt
+#define RECONNECT_DELAY 500
+#define RECONNECT_MAX_DELAY 30000
+
+//##############################################################################
+// Type definitions
+//##############################################################################
+// All mixer calls are made by a thread which owns the snd_mixer_t, so a
+// device which blocks can't freeze the tray icon. The main loop sends it
+// commands and gets snapshots of the state back, both through AsoundQueue.
+// Each call to setup starts a new AsoundSession with its own thread.
+typedef struct AsoundSession AsoundSession;
+
+// Snapshot of the mixer element we're listening to. It is refreshed whenever
+// the element changes so that the getters don't have to query alsa-lib.
+typedef struct {
+	long raw; // raw playback volume of the first channel
+	long dB; // playback volume in 0.01 dB of the first channel
+	int volume; // volume from [0-100] using the element's volume table
+	gboolean mute;
+} AsoundState;
+
+// Playback element of the mixer together with its cached capabilities. The
+// name includes the element index if it isn't zero, like alsamixer does.
+typedef struct {
+	gchar *name;
+	snd_mixer_elem_t *elem;
+	gboolean has_switch;
+	struct volume_table table; // only valid for the session's element
+	AsoundSession *session;
+} AsoundElement;
+
+// GSource which watches all poll descriptors of a mixer.
+typedef struct {
+	GSource source;
+	snd_mixer_t *mixer;
+	struct pollfd *pfds;
+	GPollFD *fds;
+	int count;
+} AsoundSource;
+
+// Sound cards which are being probed by the worker pool. Everything but the
+// reference count is protected by m_card_list_mutex.
+typedef struct {
+	gint ref_count;
+	int count;
+	int pending;
+	int *card_numbers;
+	gchar **names; // nice names, NULL if the card couldn't be probed
+} AsoundCardList;
+
+typedef struct {
+	AsoundCardList *list;
+	int slot;
+} AsoundCardProbe;
+
+// Ring buffer with a single producer and a single consumer. One slot is
+// always left empty to tell a full queue from an empty one.
+typedef struct {
+	gpointer slots[QUEUE_SIZE];
+	gint head; // next slot to pop, only written by the consumer
+	gint tail; // next slot to push, only written by the producer
+} AsoundQueue;
+
+typedef enum {
+	ASOUND_COMMAND_SETUP,
+	ASOUND_COMMAND_SET_CHANNEL,
+	ASOUND_COMMAND_SET_VOLUME,
+	ASOUND_COMMAND_SET_MUTE,
+	ASOUND_COMMAND_SET_STATE,
+	ASOUND_COMMAND_SET_CURVE,
+	ASOUND_COMMAND_LOAD_CHANNELS,
+	ASOUND_COMMAND_SYNC // does nothing, lets close wait for the commands
+} AsoundCommandType;
+
+typedef struct {
+	AsoundCommandType type;
+	int value; // volume, mute or curve
+	gboolean mute; // only for set_state
+	gchar *device; // only for setup
+	gchar *channel; // for setup and set_channel
+	gboolean load_all; // only for setup, FALSE loads just the channel
+	guint serial; // non-zero if the main loop waits for the command
+} AsoundCommand;
+
+// What the main loop knows about the mixer, sent after every change
+typedef struct {
+	int volume;
+	gboolean mute;
+	gboolean open; // FALSE if the mixer couldn't be opened or was closed
+	gchar *channel; // channel picked by setup, NULL otherwise
+	gboolean channels_changed;
+	GList *channel_names; // only valid if channels_changed
+	gboolean notify; // FALSE if nothing but our own writes changed it
+	gboolean setup; // answer to the setup command
+	gboolean spinning; // the mixer was closed because it kept waking us up
+} AsoundSnapshot;
+
+struct AsoundSession {
+	gint ref_count;
+	GMainContext *context;
+	GMainLoop *loop;
+	AsoundQueue commands; // main loop -> mixer thread
+	AsoundQueue snapshots; // mixer thread -> main loop
+	gint snapshots_scheduled; // an idle callback drains the snapshots
+
+	// Lets the main loop wait for a command or for room in the command
+	// queue, the fields are protected by mutex
+	GMutex mutex;
+	GCond cond;
+	guint completed; // serial of the last command waited for
+
+	// Start of the running mixer call in milliseconds, cut to 32 bits, or 0
+	// if the thread is idle. Set by the mixer thread, atomic.
+	gint busy_since;
+	gint quit; // set by the main loop to end the thread, atomic
+
+	// Only used by the mixer thread
+	AsoundCardList *card_list;
+	snd_mixer_t *mixer;
+	snd_hctl_t *hctl;
+	GSource *source;
+	GHashTable *elements;
+
+	// Until all channels are asked for, only the controls of the channel
+	// setup wants are turned into elements. The others are kept in skipped.
+	snd_mixer_class_t *selem_class;
+	snd_mixer_event_t selem_event; // event handler of selem_class
+	GHashTable *skipped; // NULL once everything is loaded
+	gchar *lazy_name;
+	unsigned int lazy_index;
+	GList *channel_names;
+	gboolean channel_names_changed;
+	AsoundElement *element;
+	gchar *channel;
+	AsoundState state;
+	enum volume_curve curve;
+	AsoundSnapshot *unsent; // didn't fit into the snapshot queue yet
+	gint64 spin_start; // start of the second dispatches are counted for
+	int spin_count;
+	gboolean spinning; // reported with the next snapshot
+
+	// Only used by the main loop
+	GQueue *overflow; // commands which didn't fit into the command queue
+	guint serial;
+};
+
+// GSource which runs the commands of a session on the mixer thread
+typedef struct {
+	GSource source;
+	AsoundSession *session;
+} AsoundQueueSource;
+
 //##############################################################################
 // Static variables
 //##############################################################################
-static snd_mixer_elem_t *m_elem = NULL;
+static AsoundSession *m_session = NULL;
+static int m_volume = 0;
+static gboolean m_mute = TRUE;
+static gboolean m_open = FALSE;
+static enum volume_curve m_curve = VOLUME_CURVE_ALSAMIXER;
+static guint m_notify_id = 0;
+static guint m_watchdog_id = 0;
+static guint m_reconnect_id = 0;
+static gboolean m_reconnecting = FALSE;
+static int m_reconnect_delay = RECONNECT_DELAY;
+static guint m_stall_count = 0;
+static gint64 m_stall_time = 0; // in microseconds
+static gint64 m_stall_longest = 0;
+static guint m_reconnect_count = 0;
 static char *m_channel = NULL;
 static char *m_device = NULL;
-static snd_mixer_t *m_mixer = NULL;
 static GList *m_channel_names = NULL;
+static gboolean m_load_channels = FALSE; // all of them, not just ours
 static GList *m_device_names = NULL;
+static gboolean m_device_names_complete = FALSE;
+static AsoundCardList *m_card_list = NULL;
+static GThreadPool *m_card_probe_pool = NULL;
+static GMutex m_card_list_mutex;
+static GCond m_card_list_cond;
 static void (*m_volume_changed)(int, gboolean);
+static void (*m_devices_changed)(void) = NULL;
+
+//##############################################################################
+// Function prototypes
+//##############################################################################
+static int asound_elem_event(snd_mixer_elem_t *elem, unsigned int mask);
+static int asound_mixer_event(snd_mixer_t *mixer, unsigned int mask,
+                              snd_mixer_elem_t *elem);
+static gboolean asound_snapshots_cb(gpointer data);
+static void asound_reconnect_schedule();
 
 //##############################################################################
 // Static functions
 //##############################################################################
-static gboolean asound_channel_exists(const gchar *channel)
+static gboolean asound_queue_push(AsoundQueue *queue, gpointer item)
+{
+	gint tail = g_atomic_int_get(&queue->tail);
+	gint next = (tail + 1) % QUEUE_SIZE;
+	if(next == g_atomic_int_get(&queue->head))
+		return FALSE;
+	queue->slots[tail] = item;
+	g_atomic_int_set(&queue->tail, next);
+	return TRUE;
+}
+
+static gpointer asound_queue_pop(AsoundQueue *queue)
+{
+	gint head = g_atomic_int_get(&queue->head);
+	if(head == g_atomic_int_get(&queue->tail))
+		return NULL;
+	gpointer item = queue->slots[head];
+	g_atomic_int_set(&queue->head, (head + 1) % QUEUE_SIZE);
+	return item;
+}
+
+static gboolean asound_queue_is_empty(AsoundQueue *queue)
+{
+	return g_atomic_int_get(&queue->head) == g_atomic_int_get(&queue->tail);
+}
+
+static gboolean asound_queue_is_full(AsoundQueue *queue)
+{
+	return (g_atomic_int_get(&queue->tail) + 1) % QUEUE_SIZE ==
+	       g_atomic_int_get(&queue->head);
+}
+
+static AsoundCommand *asound_command_new(AsoundCommandType type, int value)
+{
+	AsoundCommand *command = g_new0(AsoundCommand, 1);
+	command->type = type;
+	command->value = value;
+	return command;
+}
+
+static void asound_command_free(gpointer data)
+{
+	AsoundCommand *command = (AsoundCommand *)data;
+	g_free(command->device);
+	g_free(command->channel);
+	g_free(command);
+}
+
+static void asound_snapshot_free(AsoundSnapshot *snapshot)
+{
+	g_free(snapshot->channel);
+	g_list_free_full(snapshot->channel_names, g_free);
+	g_free(snapshot);
+}
+
+static enum volume_curve asound_get_curve()
+{
+	if(config_get_use_logarithmic_scale())
+		return VOLUME_CURVE_LINEAR;
+
+	int curve = config_get_volume_curve();
+	if(curve < 0 || curve >= VOLUME_CURVE_COUNT)
+		return VOLUME_CURVE_ALSAMIXER;
+	return curve;
+}
+
+static AsoundCardList *asound_card_list_ref(AsoundCardList *list)
+{
+	g_atomic_int_inc(&list->ref_count);
+	return list;
+}
+
+static void asound_card_list_unref(AsoundCardList *list)
 {
-	GList *channel_name = m_channel_names;
-	while(channel_name) {
-		const gchar *name = (const gchar *)channel_name->data;
-		if(g_strcmp0(channel, name) == 0)
-			return TRUE;
-		channel_name = channel_name->next;
+	if(!g_atomic_int_dec_and_test(&list->ref_count))
+		return;
+
+	int i;
+	for(i = 0; i < list->count; i++)
+		g_free(list->names[i]);
+	g_free(list->names);
+	g_free(list->card_numbers);
+	g_free(list);
+}
+
+static void asound_build_device_names()
+{
+	g_list_free_full(m_device_names, g_free);
+	m_device_names = NULL;
+	m_device_names =
+	    g_list_prepend(m_device_names, (gpointer)g_strdup("default"));
+	gboolean encountered_provided_device = g_strcmp0("default", m_device) == 0;
+
+	g_mutex_lock(&m_card_list_mutex);
+	m_device_names_complete = m_card_list->pending == 0;
+	int i;
+	for(i = 0; i < m_card_list->count; i++) {
+		const gchar *nice_name = m_card_list->names[i];
+		if(nice_name == NULL)
+			continue;
+		m_device_names =
+		    g_list_prepend(m_device_names, (gpointer)g_strdup(nice_name));
+
+		gchar *hw_name =
+		    g_strdup_printf("hw:%d", m_card_list->card_numbers[i]);
+		if(g_strcmp0(hw_name, m_device) == 0 ||
+		   g_strcmp0(nice_name, m_device) == 0) {
+			encountered_provided_device = TRUE;
+		}
+		g_free(hw_name);
 	}
+	g_mutex_unlock(&m_card_list_mutex);
+
+	if(!encountered_provided_device) {
+		m_device_names =
+		    g_list_prepend(m_device_names, (gpointer)g_strdup(m_device));
+	}
+	m_device_names = g_list_reverse(m_device_names);
+}
+
+static gboolean asound_card_list_done(gpointer data)
+{
+	AsoundCardList *list = (AsoundCardList *)data;
+	if(list == m_card_list && !m_device_names_complete) {
+		asound_build_device_names();
+		if(m_devices_changed)
+			m_devices_changed();
+	}
+	asound_card_list_unref(list);
 	return FALSE;
 }
 
+// Runs in the worker pool, opening the control device of a card can take a
+// while for USB or HDMI devices.
+static void asound_card_probe(gpointer data, gpointer user_data)
+{
+	AsoundCardProbe *probe = (AsoundCardProbe *)data;
+	AsoundCardList *list = probe->list;
+	gchar *nice_name = NULL;
+
+	char buf[16];
+	sprintf(buf, "hw:%d", list->card_numbers[probe->slot]);
+	snd_ctl_t *ctl = NULL;
+	if(snd_ctl_open(&ctl, buf, 0) >= 0) {
+		snd_ctl_card_info_t *info = NULL;
+		snd_ctl_card_info_alloca(&info);
+		if(snd_ctl_card_info(ctl, info) >= 0)
+			nice_name = g_strdup(snd_ctl_card_info_get_name(info));
+		snd_ctl_close(ctl);
+	}
+
+	g_mutex_lock(&m_card_list_mutex);
+	list->names[probe->slot] = nice_name;
+	gboolean done = --list->pending == 0;
+	g_cond_broadcast(&m_card_list_cond);
+	g_mutex_unlock(&m_card_list_mutex);
+
+	// Hand the results over to the main loop once all cards are probed
+	if(done)
+		g_idle_add(asound_card_list_done, asound_card_list_ref(list));
+	asound_card_list_unref(list);
+	g_free(probe);
+}
+
+static AsoundCardList *asound_card_list_new()
+{
+	AsoundCardList *list = g_new0(AsoundCardList, 1);
+	list->ref_count = 1;
+
+	int card_number = -1;
+	while(snd_card_next(&card_number) == 0 && card_number != -1) {
+		list->card_numbers =
+		    g_renew(int, list->card_numbers, list->count + 1);
+		list->card_numbers[list->count++] = card_number;
+	}
+	list->names = g_new0(gchar *, list->count);
+	list->pending = list->count;
+
+	if(m_card_probe_pool == NULL) {
+		m_card_probe_pool = g_thread_pool_new(
+		    asound_card_probe, NULL, CARD_PROBE_THREADS, FALSE, NULL);
+	}
+	int i;
+	for(i = 0; i < list->count; i++) {
+		AsoundCardProbe *probe = g_new(AsoundCardProbe, 1);
+		probe->list = asound_card_list_ref(list);
+		probe->slot = i;
+		g_thread_pool_push(m_card_probe_pool, probe, NULL);
+	}
+	return list;
+}
+
+// Waits until a card with the given nice name shows up in the list, returns
+// its hw name or NULL if no card matches. Called from the mixer thread.
+static gchar *asound_card_list_lookup(AsoundCardList *list,
+                                      const gchar *nice_name)
+{
+	gchar *hw_name = NULL;
+
+	g_mutex_lock(&m_card_list_mutex);
+	while(hw_name == NULL) {
+		int i;
+		for(i = 0; i < list->count && hw_name == NULL; i++) {
+			if(g_strcmp0(list->names[i], nice_name) == 0)
+				hw_name = g_strdup_printf("hw:%d", list->card_numbers[i]);
+		}
+		if(list->pending == 0)
+			break;
+		if(hw_name == NULL)
+			g_cond_wait(&m_card_list_cond, &m_card_list_mutex);
+	}
+	g_mutex_unlock(&m_card_list_mutex);
+	return hw_name;
+}
+
+static void asound_silent_error_handler(const char *file, int line,
+                                        const char *function, int err,
+                                        const char *fmt, ...)
+{
+}
+
+static snd_mixer_t *asound_mixer_open(const gchar *name, gboolean quiet)
+{
+	snd_mixer_t *mixer = NULL;
+	if(snd_mixer_open(&mixer, 0) < 0)
+		return NULL;
+
+	if(quiet)
+		snd_lib_error_set_handler(asound_silent_error_handler);
+	int ret = snd_mixer_attach(mixer, name);
+	if(quiet)
+		snd_lib_error_set_handler(NULL);
+
+	if(ret < 0) {
+		snd_mixer_close(mixer);
+		return NULL;
+	}
+	return mixer;
+}
+
+static AsoundSession *asound_session_ref(AsoundSession *session)
+{
+	g_atomic_int_inc(&session->ref_count);
+	return session;
+}
+
+static void asound_session_unref(AsoundSession *session)
+{
+	if(!g_atomic_int_dec_and_test(&session->ref_count))
+		return;
+
+	AsoundCommand *command;
+	while((command = asound_queue_pop(&session->commands)))
+		asound_command_free(command);
+	g_queue_free_full(session->overflow, asound_command_free);
+
+	AsoundSnapshot *snapshot;
+	while((snapshot = asound_queue_pop(&session->snapshots)))
+		asound_snapshot_free(snapshot);
+	if(session->unsent)
+		asound_snapshot_free(session->unsent);
+
+	asound_card_list_unref(session->card_list);
+	g_main_loop_unref(session->loop);
+	g_main_context_unref(session->context);
+	g_mutex_clear(&session->mutex);
+	g_cond_clear(&session->cond);
+	g_free(session->channel);
+	g_free(session);
+}
+
+//##############################################################################
+// Mixer thread
+//##############################################################################
+static void asound_element_free(gpointer data)
+{
+	AsoundElement *element = (AsoundElement *)data;
+	g_free(element->name);
+	g_free(element);
+}
+
+static AsoundElement *asound_element_add(AsoundSession *session,
+                                         snd_mixer_elem_t *elem)
+{
+	const char *name = snd_mixer_selem_get_name(elem);
+	unsigned int index = snd_mixer_selem_get_index(elem);
+	gchar *element_name = index == 0 ? g_strdup(name) :
+	                                   g_strdup_printf("%s,%u", name, index);
+	AsoundElement *element =
+	    g_hash_table_lookup(session->elements, element_name);
+	if(element) {
+		g_free(element_name);
+		return element;
+	}
+
+	element = g_new(AsoundElement, 1);
+	element->name = element_name;
+	element->elem = elem;
+	element->has_switch = snd_mixer_selem_has_playback_switch(elem);
+	element->session = session;
+	g_hash_table_insert(session->elements, element->name, element);
+
+	// Every element gets a callback so we notice when it's removed
+	snd_mixer_elem_set_callback_private(elem, element);
+	snd_mixer_elem_set_callback(elem, asound_elem_event);
+	return element;
+}
+
+static void asound_element_remove(AsoundElement *element)
+{
+	AsoundSession *session = element->session;
+	snd_mixer_elem_set_callback(element->elem, NULL);
+	session->channel_names =
+	    g_list_remove(session->channel_names, element->name);
+	session->channel_names_changed = TRUE;
+	g_hash_table_remove(session->elements, element->name);
+}
+
+// Registers all playback elements of the mixer, the channel names are kept
+// in mixer order.
+static void asound_elements_load(AsoundSession *session)
+{
+	g_list_free(session->channel_names);
+	session->channel_names = NULL;
+
+	snd_mixer_elem_t *elem;
+	for(elem = snd_mixer_first_elem(session->mixer); elem != NULL;
+	    elem = snd_mixer_elem_next(elem)) {
+		if(snd_mixer_selem_has_playback_volume(elem)) {
+			AsoundElement *element = asound_element_add(session, elem);
+			if(element->elem != elem)
+				continue; // duplicate name
+			session->channel_names = g_list_prepend(session->channel_names,
+			                                        (gpointer)element->name);
+		}
+	}
+	session->channel_names = g_list_reverse(session->channel_names);
+	session->channel_names_changed = TRUE;
+}
+
+// Tells if a control belongs to the channel setup wants, like "Master
+// Playback Volume" does to "Master"
+static gboolean asound_control_wanted(AsoundSession *session,
+                                      snd_hctl_elem_t *helem)
+{
+	const char *name = snd_hctl_elem_get_name(helem);
+	size_t length = strlen(session->lazy_name);
+	return snd_hctl_elem_get_index(helem) == session->lazy_index &&
+	       strncmp(name, session->lazy_name, length) == 0 &&
+	       (name[length] == '\0' || name[length] == ' ');
+}
+
+// Event handler of the simple mixer class which holds back new controls of
+// other channels. The removal event has all bits set, so it isn't taken for
+// an added control.
+static int asound_selem_event(snd_mixer_class_t *class, unsigned int mask,
+                              snd_hctl_elem_t *helem, snd_mixer_elem_t *melem)
+{
+	AsoundSession *session = (AsoundSession *)snd_mixer_get_callback_private(
+	    snd_mixer_class_get_mixer(class));
+	if(session->skipped && mask != SND_CTL_EVENT_MASK_REMOVE &&
+	   (mask & SND_CTL_EVENT_MASK_ADD)) {
+		if(!asound_control_wanted(session, helem)) {
+			g_hash_table_add(session->skipped, helem);
+			return 0;
+		}
+		g_hash_table_remove(session->skipped, helem);
+	}
+	return session->selem_event(class, mask, helem, melem);
+}
+
+// Makes snd_mixer_load only turn the controls of the channel into elements.
+// A channel name like "PCM,1" is the name and index of its controls.
+static void asound_elements_filter(AsoundSession *session,
+                                   const gchar *channel)
+{
+	if(session->hctl == NULL || session->selem_class == NULL)
+		return;
+
+	session->lazy_name = g_strdup(channel);
+	session->lazy_index = 0;
+	gchar *separator = strrchr(session->lazy_name, ',');
+	if(separator && separator[1] != '\0' &&
+	   strspn(separator + 1, "0123456789") == strlen(separator + 1)) {
+		session->lazy_index = atoi(separator + 1);
+		*separator = '\0';
+	}
+
+	session->skipped = g_hash_table_new(NULL, NULL);
+	session->selem_event = snd_mixer_class_get_event(session->selem_class);
+	snd_mixer_class_set_event(session->selem_class, asound_selem_event);
+}
+
+// Hands the controls which were held back to the simple mixer class and
+// lists all channels. The controls removed since are gone from the hctl,
+// so the stale entries in skipped are never looked at.
+static void asound_elements_load_all(AsoundSession *session)
+{
+	if(session->skipped == NULL)
+		return;
+	GHashTable *skipped = session->skipped;
+	session->skipped = NULL;
+
+	// The new elements are registered below, in mixer order
+	snd_mixer_set_callback(session->mixer, NULL);
+	snd_hctl_elem_t *helem;
+	for(helem = snd_hctl_first_elem(session->hctl); helem != NULL;
+	    helem = snd_hctl_elem_next(helem)) {
+		if(g_hash_table_contains(skipped, helem))
+			session->selem_event(session->selem_class,
+			                     SND_CTL_EVENT_MASK_ADD, helem, NULL);
+	}
+	g_hash_table_destroy(skipped);
+	snd_mixer_set_callback(session->mixer, asound_mixer_event);
+	asound_elements_load(session);
+}
+
+static void asound_state_refresh(AsoundSession *session)
+{
+	AsoundElement *element = session->element;
+	AsoundState *state = &session->state;
+	if(element == NULL) {
+		state->raw = 0;
+		state->dB = 0;
+		state->volume = 0;
+		state->mute = TRUE;
+		return;
+	}
+
+	snd_mixer_elem_t *elem = element->elem;
+	snd_mixer_selem_get_playback_volume(elem, 0, &state->raw);
+	if(snd_mixer_selem_get_playback_dB(elem, 0, &state->dB) < 0)
+		state->dB = 0;
+	state->volume = volume_table_lookup(
+	    &element->table, element->table.use_dB ? state->dB : state->raw);
+
+	state->mute = FALSE;
+	if(element->has_switch) {
+		int pswitch;
+		snd_mixer_selem_get_playback_switch(elem, 0, &pswitch);
+		state->mute = pswitch ? FALSE : TRUE;
+	}
+}
+
+// Makes element the one we're listening to, NULL if the channel is missing
+static void asound_element_bind(AsoundSession *session,
+                                AsoundElement *element)
+{
+	if(element != NULL)
+		volume_table_init(&element->table, element->elem, session->curve);
+	session->element = element;
+	asound_state_refresh(session);
+}
+
+static gboolean asound_state_equal(const AsoundState *a, const AsoundState *b)
+{
+	return a->raw == b->raw && a->dB == b->dB && a->mute == b->mute;
+}
+
+static void asound_session_send_unsent(AsoundSession *session)
+{
+	if(session->unsent == NULL ||
+	   !asound_queue_push(&session->snapshots, session->unsent))
+		return;
+	session->unsent = NULL;
+
+	if(g_atomic_int_compare_and_exchange(&session->snapshots_scheduled, 0, 1))
+		g_idle_add(asound_snapshots_cb, asound_session_ref(session));
+}
+
+// Hands the current state over to the main loop. If the main loop is lagging
+// behind the snapshot is merged with the one still waiting to be sent.
+static void asound_session_publish(AsoundSession *session, gboolean notify,
+                                   const gchar *channel, gboolean setup)
+{
+	AsoundSnapshot *snapshot = g_new0(AsoundSnapshot, 1);
+	snapshot->volume = session->state.volume;
+	snapshot->mute = session->state.mute;
+	snapshot->open = session->mixer != NULL;
+	snapshot->channel = g_strdup(channel);
+	snapshot->notify = notify;
+	snapshot->setup = setup;
+	snapshot->spinning = session->spinning;
+	session->spinning = FALSE;
+	if(session->channel_names_changed) {
+		snapshot->channels_changed = TRUE;
+		snapshot->channel_names = g_list_copy_deep(
+		    session->channel_names, (GCopyFunc)g_strdup, NULL);
+		session->channel_names_changed = FALSE;
+	}
+
+	AsoundSnapshot *unsent = session->unsent;
+	if(unsent) {
+		snapshot->notify |= unsent->notify;
+		snapshot->setup |= unsent->setup;
+		snapshot->spinning |= unsent->spinning;
+		if(snapshot->channel == NULL) {
+			snapshot->channel = unsent->channel;
+			unsent->channel = NULL;
+		}
+		if(!snapshot->channels_changed && unsent->channels_changed) {
+			snapshot->channels_changed = TRUE;
+			snapshot->channel_names = unsent->channel_names;
+			unsent->channel_names = NULL;
+		}
+		asound_snapshot_free(unsent);
+	}
+	session->unsent = snapshot;
+	asound_session_send_unsent(session);
+}
+
 static int asound_elem_event(snd_mixer_elem_t *elem, unsigned int mask)
 {
-	assert(m_elem == elem);
+	AsoundElement *element =
+	    (AsoundElement *)snd_mixer_elem_get_callback_private(elem);
+	AsoundSession *session = element->session;
+
+	// The element is gone, most likely because its card was unplugged. We
+	// keep the channel name, so it's picked up again if it comes back.
+	if(mask == SND_CTL_EVENT_MASK_REMOVE) {
+		gboolean active = element == session->element;
+		asound_element_remove(element);
+		if(active)
+			asound_element_bind(session, NULL);
+		if(active || session->channel_names_changed)
+			asound_session_publish(session, active, NULL, FALSE);
+		return 0;
+	}
 
-	m_volume_changed(asound_get_volume(), asound_get_mute());
+	// We only keep track of the state of the element we're using
+	if(element != session->element)
+		return 0;
+
+	// The range or dB information changed, so rebuild what depends on it
+	if(mask & SND_CTL_EVENT_MASK_INFO) {
+		element->has_switch = snd_mixer_selem_has_playback_switch(elem);
+		volume_table_init(&element->table, elem, session->curve);
+	}
+
+	// Our own writes already updated the state, so their echoes don't change
+	// it and can be skipped.
+	AsoundState previous = session->state;
+	asound_state_refresh(session);
+	if(!(mask & SND_CTL_EVENT_MASK_INFO) &&
+	   asound_state_equal(&previous, &session->state))
+		return 0;
+
+	asound_session_publish(session, TRUE, NULL, FALSE);
 	return 0;
 }
 
-static gboolean asound_poll_cb(GIOChannel *source, GIOCondition condition,
-                               gpointer data)
+static int asound_mixer_event(snd_mixer_t *mixer, unsigned int mask,
+                              snd_mixer_elem_t *elem)
 {
-	int retval = snd_mixer_handle_events(m_mixer);
+	AsoundSession *session =
+	    (AsoundSession *)snd_mixer_get_callback_private(mixer);
+
+	if((mask & SND_CTL_EVENT_MASK_ADD) &&
+	   snd_mixer_selem_has_playback_volume(elem)) {
+		// An element we already know of keeps its place in the list
+		guint count = g_hash_table_size(session->elements);
+		AsoundElement *element = asound_element_add(session, elem);
+		if(g_hash_table_size(session->elements) > count) {
+			session->channel_names = g_list_append(session->channel_names,
+			                                       (gpointer)element->name);
+			session->channel_names_changed = TRUE;
+
+			// The channel we were using is back
+			gboolean wanted = session->element == NULL &&
+			                  g_strcmp0(element->name, session->channel) == 0;
+			if(wanted)
+				asound_element_bind(session, element);
+			asound_session_publish(session, wanted, NULL, FALSE);
+		}
+	}
+	return 0;
+}
+
+static gboolean asound_source_prepare(GSource *source, gint *timeout)
+{
+	*timeout = -1;
+	return FALSE;
+}
+
+static gboolean asound_source_check(GSource *source)
+{
+	AsoundSource *asource = (AsoundSource *)source;
+	unsigned short revents = 0;
+	int i;
+
+	// Let alsa-lib demangle the returned events, some plugins use poll
+	// descriptors which don't map directly onto mixer events.
+	for(i = 0; i < asource->count; i++)
+		asource->pfds[i].revents = asource->fds[i].revents;
+	if(snd_mixer_poll_descriptors_revents(asource->mixer, asource->pfds,
+	                                      asource->count, &revents) < 0)
+		return TRUE;
+	return revents != 0;
+}
+
+static gboolean asound_source_dispatch(GSource *source, GSourceFunc callback,
+                                       gpointer user_data)
+{
+	if(callback == NULL)
+		return FALSE;
+	return callback(user_data);
+}
+
+static void asound_source_finalize(GSource *source)
+{
+	AsoundSource *asource = (AsoundSource *)source;
+	g_free(asource->pfds);
+	g_free(asource->fds);
+}
+
+static GSourceFuncs asound_source_funcs = {
+    asound_source_prepare, asound_source_check, asound_source_dispatch,
+    asound_source_finalize};
+
+static GSource *asound_source_new(snd_mixer_t *mixer)
+{
+	int count = snd_mixer_poll_descriptors_count(mixer);
+	if(count <= 0)
+		return NULL;
+
+	GSource *source = g_source_new(&asound_source_funcs, sizeof(AsoundSource));
+	AsoundSource *asource = (AsoundSource *)source;
+	asource->mixer = mixer;
+	asource->pfds = g_new0(struct pollfd, count);
+	asource->fds = g_new0(GPollFD, count);
+	asource->count = snd_mixer_poll_descriptors(mixer, asource->pfds, count);
+
+	int i;
+	for(i = 0; i < asource->count; i++) {
+		asource->fds[i].fd = asource->pfds[i].fd;
+		asource->fds[i].events = asource->pfds[i].events;
+		g_source_add_poll(source, &asource->fds[i]);
+	}
+	return source;
+}
+
+static void asound_mixer_close(AsoundSession *session)
+{
+	session->element = NULL;
+	asound_state_refresh(session);
+	if(session->source) {
+		g_source_destroy(session->source);
+		g_source_unref(session->source);
+		session->source = NULL;
+	}
+	if(session->mixer) {
+		// Closing the mixer removes all elements, we don't want to hear
+		// about that.
+		snd_mixer_set_callback(session->mixer, NULL);
+		if(session->elements) {
+			GHashTableIter iter;
+			gpointer element;
+			g_hash_table_iter_init(&iter, session->elements);
+			while(g_hash_table_iter_next(&iter, NULL, &element))
+				snd_mixer_elem_set_callback(
+				    ((AsoundElement *)element)->elem, NULL);
+		}
+		snd_mixer_close(session->mixer);
+		session->mixer = NULL;
+	}
+	if(session->channel_names) {
+		g_list_free(session->channel_names);
+		session->channel_names = NULL;
+		session->channel_names_changed = TRUE;
+	}
+	if(session->elements) {
+		g_hash_table_destroy(session->elements);
+		session->elements = NULL;
+	}
+	if(session->skipped) {
+		g_hash_table_destroy(session->skipped);
+		session->skipped = NULL;
+	}
+	g_free(session->lazy_name);
+	session->lazy_name = NULL;
+	session->hctl = NULL;
+	session->selem_class = NULL;
+}
+
+// Monotonic clock in milliseconds cut to 32 bits. Only differences of it are
+// looked at, so wrapping around doesn't matter. The lowest bit is always set
+// to leave 0 for an idle mixer thread.
+static guint asound_clock_ms()
+{
+	return (guint)(g_get_monotonic_time() / G_TIME_SPAN_MILLISECOND) | 1;
+}
+
+// Tells the watchdog the mixer thread is inside alsa-lib
+static void asound_session_set_busy(AsoundSession *session, gboolean busy)
+{
+	g_atomic_int_set(&session->busy_since,
+	                 busy ? (gint)asound_clock_ms() : 0);
+}
+
+// Counts the poll dispatches of the last second. A mixer which keeps waking
+// us up without anything to do, like with a dead pulseaudio plugin, is
+// closed and set up again by the main loop.
+static gboolean asound_session_spinning(AsoundSession *session)
+{
+	gint64 now = g_get_monotonic_time();
+	if(now - session->spin_start > G_TIME_SPAN_SECOND) {
+		session->spin_start = now;
+		session->spin_count = 0;
+	}
+	return ++session->spin_count > SPIN_THRESHOLD;
+}
+
+static gboolean asound_poll_cb(gpointer data)
+{
+	AsoundSession *session = (AsoundSession *)data;
+	if(asound_session_spinning(session)) {
+		fprintf(stderr, "Sound device keeps waking us up, reconnecting\n");
+		asound_mixer_close(session);
+		session->spinning = TRUE;
+		asound_session_publish(session, TRUE, NULL, FALSE);
+		return FALSE;
+	}
+
+	asound_session_set_busy(session, TRUE);
+	int retval = snd_mixer_handle_events(session->mixer);
+	asound_session_set_busy(session, FALSE);
 	if(retval < 0) {
+		// Give up on the mixer, setup is redone when the device comes back
 		fprintf(stderr, "snd_mixer_handle_events: %s\n", snd_strerror(retval));
-		gtk_main_quit();
+		asound_mixer_close(session);
+		asound_session_publish(session, TRUE, NULL, FALSE);
 		return FALSE;
 	}
 	return TRUE;
 }
 
-//##############################################################################
-// Exported functions
-//##############################################################################
-const gchar *asound_get_channel() { return m_channel; }
+static void asound_mixer_set_channel(AsoundSession *session,
+                                     const gchar *channel)
+{
+	if(session->mixer == NULL || channel == NULL) {
+		return;
+	}
+	// A channel which went away is looked up again
+	if(g_strcmp0(channel, session->channel) == 0 && session->element != NULL)
+		return;
 
-const gchar *asound_get_device() { return m_device; }
+	// Clean up any previously set channels
+	g_free(session->channel);
+	session->channel = g_strdup(channel);
 
-const GList *asound_get_channel_names() { return m_channel_names; }
+	// Setup the element using the provided channelname, it might be one
+	// which isn't loaded yet
+	AsoundElement *element = g_hash_table_lookup(session->elements, channel);
+	if(element == NULL && session->skipped != NULL) {
+		asound_elements_load_all(session);
+		element = g_hash_table_lookup(session->elements, channel);
+	}
+	asound_element_bind(session, element);
+}
 
-const GList *asound_get_device_names() { return m_device_names; }
+static void asound_mixer_setup(AsoundSession *session, const gchar *device,
+                               const gchar *channel, gboolean load_all)
+{
+	// Load the mixer for the provided cardname. If it isn't a name alsa-lib
+	// knows about it might be the nice name of one of the cards.
+	gchar *name = g_strdup(device);
+	session->mixer = asound_mixer_open(name, TRUE);
+	if(session->mixer == NULL) {
+		g_free(name);
+		name = asound_card_list_lookup(session->card_list, device);
+		if(name != NULL)
+			session->mixer = asound_mixer_open(name, FALSE);
+	}
+	if(session->mixer == NULL) {
+		fprintf(stderr, "Failed to open sound device with name: %s\n",
+		        device);
+		g_free(name);
+		return;
+	}
+	snd_mixer_get_hctl(session->mixer, name, &session->hctl);
+	g_free(name);
 
-int asound_get_volume()
+	// Cards can have hundreds of controls, we only need those of the
+	// channel until the others are asked for
+	snd_mixer_selem_register(session->mixer, NULL, &session->selem_class);
+	snd_mixer_set_callback_private(session->mixer, session);
+	if(!load_all && channel != NULL)
+		asound_elements_filter(session, channel);
+	snd_mixer_load(session->mixer);
+
+	// Watch the poll descriptors of the mixer
+	session->source = asound_source_new(session->mixer);
+	if(session->source) {
+		g_source_set_callback(session->source, asound_poll_cb, session, NULL);
+		g_source_attach(session->source, session->context);
+	}
+
+	session->elements = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+	                                          asound_element_free);
+	asound_elements_load(session);
+	snd_mixer_set_callback(session->mixer, asound_mixer_event);
+
+	// Setup the element using the provided channelname, if it doesn't exist
+	// the first of all channels is used
+	if(channel != NULL && !g_hash_table_contains(session->elements, channel))
+		asound_elements_load_all(session);
+	if(channel != NULL && g_hash_table_contains(session->elements, channel))
+		asound_mixer_set_channel(session, channel);
+	else if(session->channel_names != NULL)
+		asound_mixer_set_channel(
+		    session, (const gchar *)session->channel_names->data);
+}
+
+static void asound_mixer_set_volume(AsoundSession *session, int volume)
 {
-	if(m_elem == NULL) {
-		return 0;
+	AsoundElement *element = session->element;
+	if(element == NULL) {
+		return;
 	}
+	volume = (volume < 0 ? 0 : (volume > 100 ? 100 : volume));
 
-	// Return the current volume value from [0-100]
-	if(config_get_use_logarithmic_scale()) {
-		long pmin, pmax, value;
-		snd_mixer_selem_get_playback_volume_range(m_elem, &pmin, &pmax);
-		snd_mixer_selem_get_playback_volume(m_elem, 0, &value);
-		return 100 * (value - pmin) / (pmax - pmin);
+	volume_table_set_playback_volume_all(&element->table, element->elem,
+	                                     volume);
+	asound_state_refresh(session);
+}
+
+static void asound_mixer_set_mute(AsoundSession *session, gboolean mute)
+{
+	AsoundElement *element = session->element;
+	if(element == NULL) {
+		return;
+	}
+
+	if(element->has_switch) {
+		snd_mixer_selem_set_playback_switch_all(element->elem, !mute);
+		asound_state_refresh(session);
+	}
+	else if(mute) {
+		asound_mixer_set_volume(session, 0);
 	}
-	else
-		return rint(100 * get_normalized_playback_volume(m_elem, 0));
 }
 
-gboolean asound_get_mute()
+// Only the controls which change are written. Muting happens before and
+// unmuting after the volume change, so the step in between isn't heard.
+static void asound_mixer_set_state(AsoundSession *session, int volume,
+                                   gboolean mute)
 {
-	if(m_elem == NULL) {
-		return TRUE;
+	AsoundElement *element = session->element;
+	if(element == NULL) {
+		return;
+	}
+	volume = (volume < 0 ? 0 : (volume > 100 ? 100 : volume));
+	if(!element->has_switch) {
+		asound_mixer_set_volume(session, mute ? 0 : volume);
+		return;
 	}
 
-	gboolean mute = FALSE;
-	if(snd_mixer_selem_has_playback_switch(m_elem)) {
-		int pswitch;
-		snd_mixer_selem_get_playback_switch(m_elem, 0, &pswitch);
-		mute = pswitch ? FALSE : TRUE;
+	AsoundState *state = &session->state;
+	if(mute && !state->mute)
+		snd_mixer_selem_set_playback_switch_all(element->elem, 0);
+	if(volume != state->volume) {
+		volume_table_set_playback_volume_all(&element->table, element->elem,
+		                                     volume);
 	}
-	return mute;
+	if(!mute && state->mute)
+		snd_mixer_selem_set_playback_switch_all(element->elem, 1);
+	asound_state_refresh(session);
 }
 
-gboolean asound_setup(const gchar *card, const gchar *channel,
-                      void (*volume_changed)(int, gboolean))
+// Rebuilds the volume table of the element if the configured curve changed
+static void asound_mixer_set_curve(AsoundSession *session,
+                                   enum volume_curve curve)
+{
+	session->curve = curve;
+	AsoundElement *element = session->element;
+	if(element == NULL || element->table.curve == curve)
+		return;
+	volume_table_init(&element->table, element->elem, curve);
+	asound_state_refresh(session);
+}
+
+static void asound_session_run_command(AsoundSession *session,
+                                       AsoundCommand *command)
 {
-	gchar *card_override = NULL; // used to hold a string like hw:0 if a nice
-	// device name was given as 'card'
+	// Changes the main loop asked for itself are sent back without
+	// notification, like the echoes of our writes are skipped.
+	gboolean notify = TRUE;
+	asound_session_set_busy(session, TRUE);
+	switch(command->type) {
+	case ASOUND_COMMAND_SETUP:
+		session->curve = command->value;
+		asound_mixer_setup(session, command->device, command->channel,
+		                   command->load_all);
+		break;
+	case ASOUND_COMMAND_SET_CHANNEL:
+		asound_mixer_set_channel(session, command->channel);
+		break;
+	case ASOUND_COMMAND_SET_VOLUME:
+		asound_mixer_set_volume(session, command->value);
+		notify = FALSE;
+		break;
+	case ASOUND_COMMAND_SET_MUTE:
+		asound_mixer_set_mute(session, command->value);
+		notify = FALSE;
+		break;
+	case ASOUND_COMMAND_SET_STATE:
+		asound_mixer_set_state(session, command->value, command->mute);
+		notify = FALSE;
+		break;
+	case ASOUND_COMMAND_SET_CURVE:
+		asound_mixer_set_curve(session, command->value);
+		break;
+	case ASOUND_COMMAND_LOAD_CHANNELS:
+		asound_elements_load_all(session);
+		notify = FALSE;
+		break;
+	case ASOUND_COMMAND_SYNC:
+		notify = FALSE;
+		break;
+	}
+	asound_session_set_busy(session, FALSE);
 
-	// Clean up resources from previous calls to setup
-	g_free(m_channel);
-	m_channel = NULL;
-	if(m_elem) {
-		snd_mixer_elem_set_callback(m_elem, NULL);
-		m_elem = NULL;
+	gboolean setup = command->type == ASOUND_COMMAND_SETUP;
+	asound_session_publish(session, notify, setup ? session->channel : NULL,
+	                       setup);
+
+	if(command->serial) {
+		g_mutex_lock(&session->mutex);
+		session->completed = command->serial;
+		g_cond_broadcast(&session->cond);
+		g_mutex_unlock(&session->mutex);
 	}
-	if(m_mixer) {
-		snd_mixer_close(m_mixer);
-		m_mixer = NULL;
+}
+
+static gboolean asound_queue_source_ready(AsoundSession *session)
+{
+	return g_atomic_int_get(&session->quit) ||
+	       !asound_queue_is_empty(&session->commands) ||
+	       (session->unsent && !asound_queue_is_full(&session->snapshots));
+}
+
+static gboolean asound_queue_source_prepare(GSource *source, gint *timeout)
+{
+	AsoundSession *session = ((AsoundQueueSource *)source)->session;
+
+	// Nothing tells us when the main loop makes room for unsent snapshots
+	*timeout = session->unsent ? 10 : -1;
+	return asound_queue_source_ready(session);
+}
+
+static gboolean asound_queue_source_check(GSource *source)
+{
+	return asound_queue_source_ready(((AsoundQueueSource *)source)->session);
+}
+
+static gboolean asound_queue_source_dispatch(GSource *source,
+                                             GSourceFunc callback,
+                                             gpointer user_data)
+{
+	AsoundSession *session = ((AsoundQueueSource *)source)->session;
+	if(g_atomic_int_get(&session->quit)) {
+		g_main_loop_quit(session->loop);
+		return FALSE;
 	}
-	g_list_free_full(m_channel_names, g_free);
-	m_channel_names = NULL;
-	g_list_free_full(m_device_names, g_free);
-	m_device_names = NULL;
+	asound_session_send_unsent(session);
 
-	// Save card, volume_changed
-	g_free(m_device);
-	m_device = g_strdup(card);
-	m_volume_changed = volume_changed;
+	AsoundCommand *command;
+	for(;;) {
+		gboolean was_full = asound_queue_is_full(&session->commands);
+		if((command = asound_queue_pop(&session->commands)) == NULL)
+			break;
 
-	// Populate list of device names
-	int card_number = -1;
-	int ret = snd_card_next(&card_number);
-	snd_ctl_card_info_t *info = NULL;
-	snd_ctl_card_info_alloca(&info);
-	m_device_names =
-	    g_list_append(m_device_names, (gpointer)g_strdup("default"));
-	gboolean encountered_provided_device = g_strcmp0("default", m_device) == 0;
-	while(ret == 0 && card_number != -1) {
-		char buf[16];
-		sprintf(buf, "hw:%d", card_number);
-		snd_ctl_t *ctl = NULL;
-		if(snd_ctl_open(&ctl, buf, 0) < 0) {
-			continue;
+		// Close might be waiting for room to flush the overflow queue
+		if(was_full) {
+			g_mutex_lock(&session->mutex);
+			g_cond_broadcast(&session->cond);
+			g_mutex_unlock(&session->mutex);
 		}
-		if(snd_ctl_card_info(ctl, info) < 0) {
-			snd_ctl_close(ctl);
-			continue;
-		}
-		snd_ctl_close(ctl);
+		asound_session_run_command(session, command);
+		asound_command_free(command);
+	}
+	return TRUE;
+}
 
-		gchar *nice_name = g_strdup(snd_ctl_card_info_get_name(info));
-		m_device_names = g_list_append(m_device_names, (gpointer)nice_name);
+static GSourceFuncs asound_queue_source_funcs = {
+    asound_queue_source_prepare, asound_queue_source_check,
+    asound_queue_source_dispatch, NULL};
 
-		if(g_strcmp0(buf, m_device) == 0) {
-			encountered_provided_device = TRUE;
+static gpointer asound_session_run(gpointer data)
+{
+	AsoundSession *session = (AsoundSession *)data;
+	g_main_context_push_thread_default(session->context);
+	g_main_loop_run(session->loop);
+	asound_mixer_close(session);
+	g_main_context_pop_thread_default(session->context);
+	asound_session_unref(session);
+	return NULL;
+}
+
+//##############################################################################
+// Main loop
+//##############################################################################
+static void asound_stall_record(gint64 stalled)
+{
+	m_stall_count++;
+	m_stall_time += stalled;
+	m_stall_longest = MAX(m_stall_longest, stalled);
+}
+
+static gboolean asound_notify_cb(gpointer data)
+{
+	m_notify_id = 0;
+	m_volume_changed(m_volume, m_mute);
+	return FALSE;
+}
+
+// Moves commands which didn't fit into the command queue before
+static void asound_session_flush(AsoundSession *session)
+{
+	gboolean pushed = FALSE;
+	while(!g_queue_is_empty(session->overflow) &&
+	      asound_queue_push(&session->commands,
+	                        g_queue_peek_head(session->overflow))) {
+		g_queue_pop_head(session->overflow);
+		pushed = TRUE;
+	}
+	if(pushed)
+		g_main_context_wakeup(session->context);
+}
+
+// Applies all snapshots the mixer thread sent. The notification is deferred
+// so that nobody is called back from inside a getter.
+static void asound_session_drain(AsoundSession *session)
+{
+	gboolean notify = FALSE;
+	gboolean channels_changed = FALSE;
+	gboolean was_open = m_open;
+	AsoundSnapshot *snapshot;
+	while((snapshot = asound_queue_pop(&session->snapshots))) {
+		m_volume = snapshot->volume;
+		m_mute = snapshot->mute;
+		m_open = snapshot->open;
+		if(snapshot->channel) {
+			g_free(m_channel);
+			m_channel = snapshot->channel;
+			snapshot->channel = NULL;
 		}
-		if(g_strcmp0(nice_name, m_device) == 0) {
-			g_free(card_override);
-			card_override = g_strdup_printf("hw:%d", card_number);
-			encountered_provided_device = TRUE;
+		if(snapshot->channels_changed) {
+			g_list_free_full(m_channel_names, g_free);
+			m_channel_names = snapshot->channel_names;
+			snapshot->channel_names = NULL;
+			channels_changed = TRUE;
+		}
+		notify |= snapshot->notify;
+		if(snapshot->spinning)
+			asound_stall_record(G_TIME_SPAN_SECOND);
+
+		// Keep trying to get a session we lost, or never had, back
+		if(snapshot->setup && snapshot->open) {
+			m_reconnecting = FALSE;
+			m_reconnect_delay = RECONNECT_DELAY;
 		}
-		ret = snd_card_next(&card_number);
+		else if(snapshot->setup || (was_open && !snapshot->open)) {
+			m_reconnecting = TRUE;
+			asound_reconnect_schedule();
+		}
+		was_open = snapshot->open;
+		asound_snapshot_free(snapshot);
 	}
-	if(!encountered_provided_device) {
-		m_device_names =
-		    g_list_append(m_device_names, (gpointer)g_strdup(m_device));
+	asound_session_flush(session);
+
+	if(channels_changed && m_devices_changed)
+		m_devices_changed();
+	if(notify && m_notify_id == 0)
+		m_notify_id = g_idle_add(asound_notify_cb, NULL);
+}
+
+static gboolean asound_snapshots_cb(gpointer data)
+{
+	AsoundSession *session = (AsoundSession *)data;
+	g_atomic_int_set(&session->snapshots_scheduled, 0);
+	if(session == m_session)
+		asound_session_drain(session);
+	asound_session_unref(session);
+	return FALSE;
+}
+
+static void asound_session_send(AsoundSession *session, AsoundCommand *command)
+{
+	if(g_queue_is_empty(session->overflow) &&
+	   asound_queue_push(&session->commands, command)) {
+		g_main_context_wakeup(session->context);
+		return;
 	}
 
-	// Load the mixer for the provided cardname
-	snd_mixer_open(&m_mixer, 0);
-	if(snd_mixer_attach(
-	       m_mixer, (card_override != NULL ? card_override : m_device)) < 0) {
-		fprintf(stderr, "Failed to open sound device with name: %s\n",
-		        (card_override != NULL ? card_override : m_device));
-		snd_mixer_close(m_mixer);
-		m_mixer = NULL;
-		g_free(card_override);
-		return FALSE;
+	// The mixer thread is lagging behind, only the last volume matters
+	AsoundCommand *last = g_queue_peek_tail(session->overflow);
+	if(last && last->type == command->type &&
+	   (command->type == ASOUND_COMMAND_SET_VOLUME ||
+	    command->type == ASOUND_COMMAND_SET_STATE)) {
+		last->value = command->value;
+		last->mute = command->mute;
+		asound_command_free(command);
+		return;
 	}
-	else {
-		g_free(card_override);
+	g_queue_push_tail(session->overflow, command);
+}
+
+// Sends a command and waits for the mixer thread to run it. Returns FALSE if
+// it didn't by end_time, the command still runs later on.
+static gboolean asound_session_call(AsoundSession *session,
+                                    AsoundCommand *command, gint64 end_time)
+{
+	guint serial = ++session->serial;
+	command->serial = serial;
+	asound_session_send(session, command);
+
+	g_mutex_lock(&session->mutex);
+	while(session->completed < serial) {
+		if(!g_cond_wait_until(&session->cond, &session->mutex, end_time))
+			break;
 	}
-	snd_mixer_selem_register(m_mixer, NULL, NULL);
-	snd_mixer_load(m_mixer);
+	gboolean completed = session->completed >= serial;
+	g_mutex_unlock(&session->mutex);
 
-	// Setup g_io_watch for the mixer
-	int count = snd_mixer_poll_descriptors_count(m_mixer);
-	if(count >= 1) {
-		struct pollfd pfd;
+	asound_session_drain(session);
+	return completed;
+}
 
-		count = snd_mixer_poll_descriptors(m_mixer, &pfd, 1);
-		if(count == 1) {
-			GIOChannel *giochannel = g_io_channel_unix_new(pfd.fd);
-			g_io_add_watch_full(giochannel, G_PRIORITY_DEFAULT,
-			                    G_IO_IN | G_IO_ERR, asound_poll_cb, NULL,
-			                    NULL);
-		}
+// Waits until the commands of the overflow queue made it into the command
+// queue. The mixer thread wakes us up whenever it makes room in a full one.
+static gboolean asound_session_flush_wait(AsoundSession *session,
+                                          gint64 end_time)
+{
+	g_mutex_lock(&session->mutex);
+	asound_session_flush(session);
+	while(!g_queue_is_empty(session->overflow)) {
+		if(asound_queue_is_full(&session->commands) &&
+		   !g_cond_wait_until(&session->cond, &session->mutex, end_time))
+			break;
+		asound_session_flush(session);
 	}
+	gboolean flushed = g_queue_is_empty(session->overflow);
+	g_mutex_unlock(&session->mutex);
+	return flushed;
+}
 
-	// Iterate over the elements in the mixer and store them in m_channel_names
-	int elemcount = snd_mixer_get_count(m_mixer);
-	snd_mixer_elem_t *elem = snd_mixer_first_elem(m_mixer);
-	int loop;
-	for(loop = 0; loop < elemcount; loop++) {
-		const char *elemname = snd_mixer_selem_get_name(elem);
-		if(snd_mixer_selem_has_playback_volume(elem)) {
-			m_channel_names =
-			    g_list_append(m_channel_names, (gpointer)g_strdup(elemname));
-		}
-		elem = snd_mixer_elem_next(elem);
+static AsoundSession *asound_session_new(AsoundCardList *card_list)
+{
+	AsoundSession *session = g_new0(AsoundSession, 1);
+	session->ref_count = 2; // one for the main loop, one for the thread
+	session->context = g_main_context_new();
+	session->loop = g_main_loop_new(session->context, FALSE);
+	g_mutex_init(&session->mutex);
+	g_cond_init(&session->cond);
+	session->card_list = asound_card_list_ref(card_list);
+	session->state.mute = TRUE;
+	session->overflow = g_queue_new();
+
+	GSource *source = g_source_new(&asound_queue_source_funcs,
+	                               sizeof(AsoundQueueSource));
+	((AsoundQueueSource *)source)->session = session;
+	g_source_attach(source, session->context);
+	g_source_unref(source);
+
+	g_thread_unref(g_thread_new("mixer", asound_session_run, session));
+	return session;
+}
+
+// Tells the mixer thread of the current session to close the mixer and
+// quit. Nobody waits for it, it might be stuck in alsa-lib. The flag gets
+// through even if the command queue is full, the commands still in there
+// are dropped.
+static void asound_session_stop()
+{
+	if(m_session == NULL)
+		return;
+	g_atomic_int_set(&m_session->quit, 1);
+	g_main_context_wakeup(m_session->context);
+	asound_session_unref(m_session);
+	m_session = NULL;
+
+	m_volume = 0;
+	m_mute = TRUE;
+	m_open = FALSE;
+	g_list_free_full(m_channel_names, g_free);
+	m_channel_names = NULL;
+}
+
+// Starts a session for m_device and sets it up. The result comes back with
+// the snapshot of the setup command.
+static void asound_session_start(const gchar *channel)
+{
+	m_session = asound_session_new(m_card_list);
+	m_curve = asound_get_curve();
+	AsoundCommand *command = asound_command_new(ASOUND_COMMAND_SETUP, m_curve);
+	command->device = g_strdup(m_device);
+	command->channel = g_strdup(channel);
+	command->load_all = m_load_channels;
+	asound_session_send(m_session, command);
+}
+
+static gboolean asound_reconnect_cb(gpointer data)
+{
+	m_reconnect_id = 0;
+	m_reconnect_count++;
+	asound_session_stop();
+	asound_session_start(m_channel);
+	return FALSE;
+}
+
+static void asound_reconnect_schedule()
+{
+	if(m_reconnect_id != 0)
+		return;
+	m_reconnect_id =
+	    g_timeout_add(m_reconnect_delay, asound_reconnect_cb, NULL);
+	m_reconnect_delay = MIN(m_reconnect_delay * 2, RECONNECT_MAX_DELAY);
+}
+
+// Abandons the session if a mixer call blocked for too long. The thread is
+// left behind, alsa-lib might never return.
+static gboolean asound_watchdog_cb(gpointer data)
+{
+	if(m_session == NULL)
+		return TRUE;
+	guint busy_since = (guint)g_atomic_int_get(&m_session->busy_since);
+	guint stalled = asound_clock_ms() - busy_since;
+	if(busy_since == 0 || stalled < STALL_THRESHOLD)
+		return TRUE;
+
+	asound_stall_record((gint64)stalled * G_TIME_SPAN_MILLISECOND);
+	fprintf(stderr, "Sound device %s stalled for %u ms, reconnecting\n",
+	        m_device, stalled);
+
+	asound_session_stop();
+	m_reconnecting = TRUE;
+	asound_reconnect_schedule();
+	if(m_notify_id == 0)
+		m_notify_id = g_idle_add(asound_notify_cb, NULL);
+	return TRUE;
+}
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+const gchar *asound_get_channel() { return m_channel; }
+
+const gchar *asound_get_device() { return m_device; }
+
+const GList *asound_get_channel_names() { return m_channel_names; }
+
+const GList *asound_get_device_names()
+{
+	// Cards that are still being probed are left out for now, the watcher
+	// hears about them once all probes are done.
+	if(m_card_list && !m_device_names_complete)
+		asound_build_device_names();
+	return m_device_names;
+}
+
+// Setup only loads the channel it was asked for, from now on every session
+// lists all of them
+void asound_load_channels()
+{
+	if(m_load_channels)
+		return;
+	m_load_channels = TRUE;
+	if(m_session) {
+		asound_session_send(
+		    m_session, asound_command_new(ASOUND_COMMAND_LOAD_CHANNELS, 0));
+	}
+}
+
+void asound_watch_devices(void (*devices_changed)(void))
+{
+	m_devices_changed = devices_changed;
+}
+
+void asound_reload_config()
+{
+	// The new volume arrives with the snapshot of the command
+	enum volume_curve curve = asound_get_curve();
+	if(m_session && curve != m_curve) {
+		m_curve = curve;
+		asound_session_send(
+		    m_session, asound_command_new(ASOUND_COMMAND_SET_CURVE, curve));
+	}
+}
+
+int asound_get_volume()
+{
+	// Return the current volume value from [0-100]
+	return m_volume;
+}
+
+gboolean asound_get_mute() { return m_mute; }
+
+void asound_print_diagnostics()
+{
+	fprintf(stderr,
+	        "Mixer stalls: %u (%d ms total, %d ms longest), %u reconnects\n",
+	        m_stall_count, (int)(m_stall_time / G_TIME_SPAN_MILLISECOND),
+	        (int)(m_stall_longest / G_TIME_SPAN_MILLISECOND),
+	        m_reconnect_count);
+}
+
+gboolean asound_probe()
+{
+	snd_ctl_t *ctl = NULL;
+	snd_lib_error_set_handler(asound_silent_error_handler);
+	int ret = snd_ctl_open(&ctl, "default", 0);
+	snd_lib_error_set_handler(NULL);
+	if(ret < 0)
+		return FALSE;
+	snd_ctl_close(ctl);
+	return TRUE;
+}
+
+// The commands run in order, so once a sync command has run the writes
+// before it are done. Those stuck in the overflow queue need room in the
+// command queue first.
+void asound_close()
+{
+	if(m_session == NULL)
+		return;
+
+	gint64 end_time =
+	    g_get_monotonic_time() + CLOSE_TIMEOUT * G_TIME_SPAN_MILLISECOND;
+	if(!asound_session_flush_wait(m_session, end_time) ||
+	   !asound_session_call(m_session,
+	                        asound_command_new(ASOUND_COMMAND_SYNC, 0),
+	                        end_time))
+		fprintf(stderr, "Timed out writing to sound device %s\n", m_device);
+	asound_session_stop();
+	if(m_watchdog_id != 0) {
+		g_source_remove(m_watchdog_id);
+		m_watchdog_id = 0;
+	}
+}
+
+gboolean asound_setup(const gchar *card, const gchar *channel,
+                      void (*volume_changed)(int, gboolean))
+{
+	// Clean up resources from previous calls to setup. The channel asked
+	// for is kept until setup tells which one it picked, so a reconnect
+	// still asks for it if the device can't be opened.
+	gchar *wanted = g_strdup(channel);
+	g_free(m_channel);
+	m_channel = wanted;
+	asound_session_stop();
+	if(m_card_list) {
+		asound_card_list_unref(m_card_list);
+		m_card_list = NULL;
+	}
+
+	// Save card, volume_changed
+	g_free(m_device);
+	m_device = g_strdup(card);
+	m_volume_changed = volume_changed;
+
+	// Start probing the sound cards in the background, the list of device
+	// names gets completed once the probes finish.
+	m_card_list = asound_card_list_new();
+	asound_build_device_names();
+
+	// A new setup replaces any attempt to get the old session back
+	if(m_reconnect_id != 0) {
+		g_source_remove(m_reconnect_id);
+		m_reconnect_id = 0;
 	}
+	m_reconnecting = FALSE;
+	m_reconnect_delay = RECONNECT_DELAY;
 
-	// Setup m_elem using the provided channelname
-	if(channel != NULL && asound_channel_exists(channel))
-		asound_set_channel(channel);
-	else if(m_channel_names != NULL)
-		asound_set_channel((const gchar *)m_channel_names->data);
+	// The watchdog checks on the current session, its mixer thread only
+	// notes when a call starts
+	if(m_watchdog_id == 0) {
+		m_watchdog_id =
+		    g_timeout_add_seconds(WATCHDOG_INTERVAL, asound_watchdog_cb, NULL);
+	}
 
+	// Open the mixer on a fresh thread without waiting for it, the state
+	// arrives once it's done. A device which can't be opened is tried again
+	// like a lost one.
+	asound_session_start(wanted);
 	return TRUE;
 }
 
 void asound_set_channel(const gchar *channel)
 {
-	if(m_mixer == NULL || channel == NULL) {
+	if(m_session == NULL || channel == NULL) {
 		return;
 	}
 	if(g_strcmp0(channel, m_channel) == 0)
 		return;
 
-	// Clean up any previously set channels
 	g_free(m_channel);
 	m_channel = g_strdup(channel);
-	if(m_elem) {
-		snd_mixer_elem_set_callback(m_elem, NULL);
-		m_elem = NULL;
-	}
 
-	// Setup m_elem using the provided channelname
-	snd_mixer_selem_id_t *sid;
-	snd_mixer_selem_id_malloc(&sid);
-	snd_mixer_selem_id_set_name(sid, channel);
-	m_elem = snd_mixer_find_selem(m_mixer, sid);
-	if(m_elem != NULL) {
-		snd_mixer_elem_set_callback(m_elem, asound_elem_event);
-		snd_mixer_selem_id_free(sid);
-	}
+	AsoundCommand *command = asound_command_new(ASOUND_COMMAND_SET_CHANNEL, 0);
+	command->channel = g_strdup(channel);
+	asound_session_send(m_session, command);
 }
 
 void asound_set_mute(gboolean mute)
 {
-	if(m_elem == NULL) {
+	if(m_session == NULL) {
 		return;
 	}
+	asound_session_send(m_session,
+	                    asound_command_new(ASOUND_COMMAND_SET_MUTE, mute));
+}
 
-	if(snd_mixer_selem_has_playback_switch(m_elem)) {
-		snd_mixer_selem_set_playback_switch_all(m_elem, !mute);
-	}
-	else if(mute) {
-		asound_set_volume(0);
+void asound_set_state(int volume, gboolean mute)
+{
+	if(m_session == NULL) {
+		return;
 	}
+	AsoundCommand *command =
+	    asound_command_new(ASOUND_COMMAND_SET_STATE, volume);
+	command->mute = mute;
+	asound_session_send(m_session, command);
 }
 
 void asound_set_volume(int volume)
 {
-	if(m_elem == NULL) {
+	if(m_session == NULL) {
 		return;
 	}
-	volume = (volume < 0 ? 0 : (volume > 100 ? 100 : volume));
-
-	if(config_get_use_logarithmic_scale()) {
-		long pmin, pmax;
-		snd_mixer_selem_get_playback_volume_range(m_elem, &pmin, &pmax);
-		long value = pmin + (pmax - pmin) * volume / 100;
-		snd_mixer_selem_set_playback_volume_all(m_elem, value);
-	}
-	else
-		set_normalized_playback_volume_all(m_elem, volume / 100.0, 0);
+	asound_session_send(m_session,
+	                    asound_command_new(ASOUND_COMMAND_SET_VOLUME, volume));
 }
@@ -24,18 +24,25 @@
 #ifndef __ALSA_BACKEND_H__
 #define __ALSA_BACKEND_H__
 
+gboolean asound_probe();
 gboolean asound_setup(const gchar *card, const gchar *channel,
                       void (*volume_changed)(int, gboolean));
 
 void asound_set_channel(const gchar *channel);
 void asound_set_volume(int volume);
 void asound_set_mute(gboolean mute);
+void asound_set_state(int volume, gboolean mute);
 
 int asound_get_volume();
 gboolean asound_get_mute();
 const gchar *asound_get_channel();
 const GList *asound_get_channel_names();
+void asound_load_channels();
 const gchar *asound_get_device();
 const GList *asound_get_device_names();
+void asound_watch_devices(void (*devices_changed)(void));
+void asound_reload_config();
+void asound_print_diagnostics();
+void asound_close();
 
 #endif
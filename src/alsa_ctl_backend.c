@@ -0,0 +1,697 @@
+//##############################################################################
+// volumeicon
+//
+// alsa_ctl_backend.c - implements a volume control abstraction using the
+//                      alsa-lib high level control interface
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+// Unlike alsa_backend.c this doesn't use the simple mixer layer. A channel
+// like "Master" is bound straight to the "Master Playback Volume" and
+// "Master Playback Switch" controls of the card, and the dB information is
+// taken from the TLV data of the volume control.
+
+#include <alsa/asoundlib.h>
+
+#include <glib.h>
+
+#include "alsa_ctl_backend.h"
+#include "alsa_volume_mapping.h"
+#include "config.h"
+
+//##############################################################################
+// Definitions
+//##############################################################################
+#define VOLUME_SUFFIX " Playback Volume"
+#define SWITCH_SUFFIX " Playback Switch"
+
+// Size of the buffer for TLV data in bytes, enough for the dB ranges of
+// common codecs.
+#define TLV_BUFFER_SIZE 512
+
+//##############################################################################
+// Type definitions
+//##############################################################################
+// Snapshot of the bound controls, refreshed whenever they change.
+typedef struct {
+	long raw; // volume of the first channel
+	int volume; // volume from [0-100] using m_table
+	gboolean mute;
+} ActlState;
+
+// A playback channel of the card. The name includes the control index if it
+// isn't zero, like alsamixer does.
+typedef struct {
+	gchar *name;
+	snd_hctl_elem_t *volume;
+	snd_hctl_elem_t *sw; // NULL if the channel has no switch
+	unsigned int volume_count; // number of values of the controls
+	unsigned int sw_count;
+} ActlChannel;
+
+// GSource which watches all poll descriptors of the control device.
+typedef struct {
+	GSource source;
+	snd_hctl_t *hctl;
+	struct pollfd *pfds;
+	GPollFD *fds;
+	int count;
+} ActlSource;
+
+//##############################################################################
+// Static variables
+//##############################################################################
+static ActlChannel *m_active = NULL;
+static ActlState m_state = {0, 0, TRUE};
+static struct volume_table m_table; // only valid for m_active
+static char *m_channel = NULL;
+static char *m_device = NULL;
+static snd_hctl_t *m_hctl = NULL;
+static GSource *m_source = NULL;
+static GHashTable *m_channels = NULL; // channel name -> ActlChannel
+static GList *m_channel_names = NULL; // in control order
+static GList *m_device_names = NULL;
+static void (*m_volume_changed)(int, gboolean) = NULL;
+
+//##############################################################################
+// Function prototypes
+//##############################################################################
+static int actl_elem_event(snd_hctl_elem_t *elem, unsigned int mask);
+
+//##############################################################################
+// Static functions
+//##############################################################################
+static enum volume_curve actl_get_curve()
+{
+	if(config_get_use_logarithmic_scale())
+		return VOLUME_CURVE_LINEAR;
+
+	int curve = config_get_volume_curve();
+	if(curve < 0 || curve >= VOLUME_CURVE_COUNT)
+		return VOLUME_CURVE_ALSAMIXER;
+	return curve;
+}
+
+// Builds m_table for the volume control of m_active. Volumes are mapped onto
+// raw values up front so that events don't need any TLV conversions.
+static void actl_table_init(enum volume_curve curve)
+{
+	snd_ctl_elem_info_t *info;
+	snd_ctl_elem_info_alloca(&info);
+	if(snd_hctl_elem_info(m_active->volume, info) < 0) {
+		volume_table_init_ranges(&m_table, curve, 0, 0, 0, 0, FALSE);
+		return;
+	}
+	long min = snd_ctl_elem_info_get_min(info);
+	long max = snd_ctl_elem_info_get_max(info);
+	m_active->volume_count = snd_ctl_elem_info_get_count(info);
+
+	unsigned int tlv[TLV_BUFFER_SIZE / sizeof(unsigned int)];
+	unsigned int *dB_tlv = NULL;
+	long dBmin = 0, dBmax = 0;
+	gboolean dB_valid =
+	    curve != VOLUME_CURVE_LINEAR &&
+	    snd_ctl_elem_info_is_tlv_readable(info) &&
+	    snd_hctl_elem_tlv_read(m_active->volume, tlv, sizeof(tlv)) >= 0 &&
+	    snd_tlv_parse_dB_info(tlv, sizeof(tlv), &dB_tlv) > 0 &&
+	    snd_tlv_get_dB_range(dB_tlv, min, max, &dBmin, &dBmax) >= 0;
+
+	volume_table_init_ranges(&m_table, curve, min, max, dBmin, dBmax,
+	                         dB_valid);
+	if(m_table.use_dB) {
+		int i;
+		for(i = 0; i < VOLUME_TABLE_SIZE; i++) {
+			long value = min;
+			snd_tlv_convert_from_dB(dB_tlv, min, max, m_table.values[i],
+			                        &value, 0);
+			m_table.values[i] = value;
+		}
+		m_table.use_dB = FALSE;
+	}
+}
+
+static void actl_state_refresh()
+{
+	snd_ctl_elem_value_t *value;
+	snd_ctl_elem_value_alloca(&value);
+
+	if(m_active == NULL || snd_hctl_elem_read(m_active->volume, value) < 0) {
+		m_state.raw = 0;
+		m_state.volume = 0;
+		m_state.mute = TRUE;
+		return;
+	}
+	m_state.raw = snd_ctl_elem_value_get_integer(value, 0);
+	m_state.volume = volume_table_lookup(&m_table, m_state.raw);
+
+	m_state.mute = FALSE;
+	if(m_active->sw && snd_hctl_elem_read(m_active->sw, value) >= 0)
+		m_state.mute = snd_ctl_elem_value_get_boolean(value, 0) ? FALSE : TRUE;
+}
+
+static void actl_write_volume(int volume)
+{
+	snd_ctl_elem_value_t *value;
+	snd_ctl_elem_value_alloca(&value);
+	unsigned int i;
+	for(i = 0; i < m_active->volume_count; i++)
+		snd_ctl_elem_value_set_integer(value, i, m_table.values[volume]);
+	snd_hctl_elem_write(m_active->volume, value);
+}
+
+static void actl_write_switch(gboolean on)
+{
+	snd_ctl_elem_value_t *value;
+	snd_ctl_elem_value_alloca(&value);
+	unsigned int i;
+	for(i = 0; i < m_active->sw_count; i++)
+		snd_ctl_elem_value_set_boolean(value, i, on);
+	snd_hctl_elem_write(m_active->sw, value);
+}
+
+// Rebuilds m_table if the configured curve changed
+static void actl_check_curve()
+{
+	enum volume_curve curve = actl_get_curve();
+	if(m_active == NULL || m_table.curve == curve)
+		return;
+	actl_table_init(curve);
+	actl_state_refresh();
+}
+
+// Returns the number of values of a control, or 0 if it isn't of the given
+// type.
+static unsigned int actl_elem_count(snd_hctl_elem_t *elem,
+                                    snd_ctl_elem_type_t type)
+{
+	snd_ctl_elem_info_t *info;
+	snd_ctl_elem_info_alloca(&info);
+	if(snd_hctl_elem_info(elem, info) < 0 ||
+	   snd_ctl_elem_info_get_type(info) != type)
+		return 0;
+	return snd_ctl_elem_info_get_count(info);
+}
+
+static ActlChannel *actl_channel_find(const gchar *name)
+{
+	if(m_channels == NULL || name == NULL)
+		return NULL;
+	return g_hash_table_lookup(m_channels, name);
+}
+
+// Returns the channel name for a control like "PCM Playback Volume" with
+// index 1, or NULL if the control doesn't end with the given suffix.
+static gchar *actl_channel_name(snd_hctl_elem_t *elem, const gchar *suffix)
+{
+	if(snd_hctl_elem_get_interface(elem) != SND_CTL_ELEM_IFACE_MIXER)
+		return NULL;
+
+	const char *name = snd_hctl_elem_get_name(elem);
+	size_t length = strlen(name);
+	size_t suffix_length = strlen(suffix);
+	if(length <= suffix_length || strcmp(name + length - suffix_length, suffix))
+		return NULL;
+
+	unsigned int index = snd_hctl_elem_get_index(elem);
+	gchar *prefix = g_strndup(name, length - suffix_length);
+	if(index == 0)
+		return prefix;
+	gchar *channel_name = g_strdup_printf("%s,%u", prefix, index);
+	g_free(prefix);
+	return channel_name;
+}
+
+static void actl_channel_bind_switch(ActlChannel *channel, snd_hctl_elem_t *sw)
+{
+	unsigned int count = actl_elem_count(sw, SND_CTL_ELEM_TYPE_BOOLEAN);
+	if(count == 0)
+		return;
+
+	channel->sw = sw;
+	channel->sw_count = count;
+	snd_hctl_elem_set_callback_private(sw, channel);
+	snd_hctl_elem_set_callback(sw, actl_elem_event);
+}
+
+// Registers a newly seen control. Volume controls add a channel, switches
+// are attached to their channel. Setup prepends the channel names and
+// reverses them once all controls are added.
+static void actl_elem_add(snd_hctl_elem_t *elem, gboolean prepend)
+{
+	gchar *name = actl_channel_name(elem, VOLUME_SUFFIX);
+	if(name) {
+		unsigned int count = actl_elem_count(elem, SND_CTL_ELEM_TYPE_INTEGER);
+		if(count == 0 || actl_channel_find(name)) {
+			g_free(name);
+			return;
+		}
+
+		ActlChannel *channel = g_new0(ActlChannel, 1);
+		channel->name = name;
+		channel->volume = elem;
+		channel->volume_count = count;
+		g_hash_table_insert(m_channels, channel->name, channel);
+		if(prepend) {
+			m_channel_names =
+			    g_list_prepend(m_channel_names, (gpointer)channel->name);
+		}
+		else {
+			m_channel_names =
+			    g_list_append(m_channel_names, (gpointer)channel->name);
+		}
+		snd_hctl_elem_set_callback_private(elem, channel);
+		snd_hctl_elem_set_callback(elem, actl_elem_event);
+
+		// The switch usually sorts before the volume control
+		snd_ctl_elem_id_t *id;
+		snd_ctl_elem_id_alloca(&id);
+		snd_hctl_elem_get_id(elem, id);
+		gchar *sw_name = g_strdup(snd_ctl_elem_id_get_name(id));
+		strcpy(sw_name + strlen(sw_name) - strlen(VOLUME_SUFFIX),
+		       SWITCH_SUFFIX);
+		snd_ctl_elem_id_set_name(id, sw_name);
+		g_free(sw_name);
+		snd_hctl_elem_t *sw = snd_hctl_find_elem(m_hctl, id);
+		if(sw)
+			actl_channel_bind_switch(channel, sw);
+		return;
+	}
+
+	name = actl_channel_name(elem, SWITCH_SUFFIX);
+	if(name) {
+		ActlChannel *channel = actl_channel_find(name);
+		if(channel && channel->sw == NULL)
+			actl_channel_bind_switch(channel, elem);
+		g_free(name);
+	}
+}
+
+static void actl_channel_free(ActlChannel *channel)
+{
+	snd_hctl_elem_set_callback(channel->volume, NULL);
+	if(channel->sw)
+		snd_hctl_elem_set_callback(channel->sw, NULL);
+	g_free(channel->name);
+	g_free(channel);
+}
+
+static int actl_elem_event(snd_hctl_elem_t *elem, unsigned int mask)
+{
+	ActlChannel *channel =
+	    (ActlChannel *)snd_hctl_elem_get_callback_private(elem);
+	if(channel == NULL)
+		return 0;
+
+	if(mask == SND_CTL_EVENT_MASK_REMOVE) {
+		gboolean active = channel == m_active;
+		if(elem == channel->sw) {
+			snd_hctl_elem_set_callback(elem, NULL);
+			channel->sw = NULL;
+		}
+		else {
+			m_channel_names = g_list_remove(m_channel_names, channel->name);
+			g_hash_table_remove(m_channels, channel->name);
+			if(active)
+				m_active = NULL;
+		}
+		if(active) {
+			actl_state_refresh();
+			m_volume_changed(actl_get_volume(), actl_get_mute());
+		}
+		return 0;
+	}
+
+	if(channel != m_active)
+		return 0;
+
+	if(mask & (SND_CTL_EVENT_MASK_INFO | SND_CTL_EVENT_MASK_TLV)) {
+		if(elem == channel->volume)
+			actl_table_init(actl_get_curve());
+		else
+			channel->sw_count =
+			    actl_elem_count(elem, SND_CTL_ELEM_TYPE_BOOLEAN);
+	}
+
+	// Skip events which don't change what we show, like the echo of our
+	// own writes
+	ActlState previous = m_state;
+	actl_state_refresh();
+	if(previous.raw == m_state.raw && previous.mute == m_state.mute &&
+	   previous.volume == m_state.volume)
+		return 0;
+
+	m_volume_changed(actl_get_volume(), actl_get_mute());
+	return 0;
+}
+
+static int actl_hctl_event(snd_hctl_t *hctl, unsigned int mask,
+                           snd_hctl_elem_t *elem)
+{
+	if(mask & SND_CTL_EVENT_MASK_ADD)
+		actl_elem_add(elem, FALSE);
+	return 0;
+}
+
+static gboolean actl_source_prepare(GSource *source, gint *timeout)
+{
+	*timeout = -1;
+	return FALSE;
+}
+
+static gboolean actl_source_check(GSource *source)
+{
+	ActlSource *asource = (ActlSource *)source;
+	unsigned short revents = 0;
+	int i;
+
+	for(i = 0; i < asource->count; i++)
+		asource->pfds[i].revents = asource->fds[i].revents;
+	if(snd_hctl_poll_descriptors_revents(asource->hctl, asource->pfds,
+	                                     asource->count, &revents) < 0)
+		return TRUE;
+	return revents != 0;
+}
+
+static gboolean actl_source_dispatch(GSource *source, GSourceFunc callback,
+                                     gpointer user_data)
+{
+	if(callback == NULL)
+		return FALSE;
+	return callback(user_data);
+}
+
+static void actl_source_finalize(GSource *source)
+{
+	ActlSource *asource = (ActlSource *)source;
+	g_free(asource->pfds);
+	g_free(asource->fds);
+}
+
+static GSourceFuncs actl_source_funcs = {
+    actl_source_prepare, actl_source_check, actl_source_dispatch,
+    actl_source_finalize};
+
+static GSource *actl_source_new(snd_hctl_t *hctl)
+{
+	int count = snd_hctl_poll_descriptors_count(hctl);
+	if(count <= 0)
+		return NULL;
+
+	GSource *source = g_source_new(&actl_source_funcs, sizeof(ActlSource));
+	ActlSource *asource = (ActlSource *)source;
+	asource->hctl = hctl;
+	asource->pfds = g_new0(struct pollfd, count);
+	asource->fds = g_new0(GPollFD, count);
+	asource->count = snd_hctl_poll_descriptors(hctl, asource->pfds, count);
+
+	int i;
+	for(i = 0; i < asource->count; i++) {
+		asource->fds[i].fd = asource->pfds[i].fd;
+		asource->fds[i].events = asource->pfds[i].events;
+		g_source_add_poll(source, &asource->fds[i]);
+	}
+	return source;
+}
+
+static void actl_close()
+{
+	m_active = NULL;
+	actl_state_refresh();
+	if(m_source) {
+		g_source_destroy(m_source);
+		g_source_unref(m_source);
+		m_source = NULL;
+	}
+	g_list_free(m_channel_names);
+	m_channel_names = NULL;
+	if(m_channels) {
+		g_hash_table_destroy(m_channels);
+		m_channels = NULL;
+	}
+	if(m_hctl) {
+		snd_hctl_set_callback(m_hctl, NULL);
+		snd_hctl_close(m_hctl);
+		m_hctl = NULL;
+	}
+}
+
+static void actl_silent_error_handler(const char *file, int line,
+                                      const char *function, int err,
+                                      const char *fmt, ...)
+{
+}
+
+static snd_hctl_t *actl_open(const gchar *name, gboolean quiet)
+{
+	snd_hctl_t *hctl = NULL;
+
+	if(quiet)
+		snd_lib_error_set_handler(actl_silent_error_handler);
+	int ret = snd_hctl_open(&hctl, name, SND_CTL_NONBLOCK);
+	if(quiet)
+		snd_lib_error_set_handler(NULL);
+
+	if(ret < 0)
+		return NULL;
+	if(snd_hctl_load(hctl) < 0) {
+		snd_hctl_close(hctl);
+		return NULL;
+	}
+	return hctl;
+}
+
+// Returns the hw name of the card with the given nice name, or NULL
+static gchar *actl_card_lookup(const gchar *nice_name)
+{
+	gchar *hw_name = NULL;
+	int card_number = -1;
+	while(hw_name == NULL && snd_card_next(&card_number) == 0 &&
+	      card_number != -1) {
+		char *name = NULL;
+		if(snd_card_get_name(card_number, &name) < 0)
+			continue;
+		if(g_strcmp0(name, nice_name) == 0)
+			hw_name = g_strdup_printf("hw:%d", card_number);
+		free(name);
+	}
+	return hw_name;
+}
+
+static void actl_build_device_names()
+{
+	g_list_free_full(m_device_names, g_free);
+	m_device_names = NULL;
+	m_device_names =
+	    g_list_prepend(m_device_names, (gpointer)g_strdup("default"));
+	gboolean encountered_provided_device = g_strcmp0("default", m_device) == 0;
+
+	int card_number = -1;
+	while(snd_card_next(&card_number) == 0 && card_number != -1) {
+		char *nice_name = NULL;
+		if(snd_card_get_name(card_number, &nice_name) < 0)
+			continue;
+		m_device_names =
+		    g_list_prepend(m_device_names, (gpointer)g_strdup(nice_name));
+
+		gchar *hw_name = g_strdup_printf("hw:%d", card_number);
+		if(g_strcmp0(hw_name, m_device) == 0 ||
+		   g_strcmp0(nice_name, m_device) == 0) {
+			encountered_provided_device = TRUE;
+		}
+		g_free(hw_name);
+		free(nice_name);
+	}
+
+	if(!encountered_provided_device) {
+		m_device_names =
+		    g_list_prepend(m_device_names, (gpointer)g_strdup(m_device));
+	}
+	m_device_names = g_list_reverse(m_device_names);
+}
+
+static gboolean actl_poll_cb(gpointer data)
+{
+	int retval = snd_hctl_handle_events(m_hctl);
+	if(retval < 0) {
+		// Give up on the device, setup is redone when it comes back
+		fprintf(stderr, "snd_hctl_handle_events: %s\n", snd_strerror(retval));
+		actl_close();
+		m_volume_changed(actl_get_volume(), actl_get_mute());
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Returns FALSE if the channel is already selected
+static gboolean actl_channel_select(const gchar *channel)
+{
+	if(g_strcmp0(channel, m_channel) == 0)
+		return FALSE;
+
+	// Clean up any previously set channels
+	g_free(m_channel);
+	m_channel = g_strdup(channel);
+
+	// Setup m_active using the provided channelname
+	m_active = actl_channel_find(channel);
+	if(m_active != NULL)
+		actl_table_init(actl_get_curve());
+	actl_state_refresh();
+	return TRUE;
+}
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+const gchar *actl_get_channel() { return m_channel; }
+
+const gchar *actl_get_device() { return m_device; }
+
+const GList *actl_get_channel_names() { return m_channel_names; }
+
+const GList *actl_get_device_names() { return m_device_names; }
+
+int actl_get_volume()
+{
+	// Return the current volume value from [0-100]
+	return m_state.volume;
+}
+
+gboolean actl_get_mute() { return m_state.mute; }
+
+gboolean actl_setup(const gchar *card, const gchar *channel,
+                    void (*volume_changed)(int, gboolean))
+{
+	// Clean up resources from previous calls to setup
+	g_free(m_channel);
+	m_channel = NULL;
+	actl_close();
+
+	// Save card, volume_changed
+	g_free(m_device);
+	m_device = g_strdup(card);
+	m_volume_changed = volume_changed;
+	actl_build_device_names();
+
+	// Open the control device for the provided cardname, which might also
+	// be the nice name of one of the cards.
+	m_hctl = actl_open(m_device, TRUE);
+	if(m_hctl == NULL) {
+		gchar *card_override = actl_card_lookup(m_device);
+		if(card_override != NULL)
+			m_hctl = actl_open(card_override, FALSE);
+		g_free(card_override);
+	}
+	if(m_hctl == NULL) {
+		fprintf(stderr, "Failed to open sound device with name: %s\n",
+		        m_device);
+		return FALSE;
+	}
+
+	m_channels = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+	                                   (GDestroyNotify)actl_channel_free);
+	snd_hctl_elem_t *elem;
+	for(elem = snd_hctl_first_elem(m_hctl); elem != NULL;
+	    elem = snd_hctl_elem_next(elem))
+		actl_elem_add(elem, TRUE);
+	m_channel_names = g_list_reverse(m_channel_names);
+	snd_hctl_set_callback(m_hctl, actl_hctl_event);
+
+	// Watch the poll descriptors of the control device
+	m_source = actl_source_new(m_hctl);
+	if(m_source) {
+		g_source_set_callback(m_source, actl_poll_cb, NULL, NULL);
+		g_source_attach(m_source, NULL);
+	}
+
+	// Setup m_active using the provided channelname
+	if(actl_channel_find(channel) != NULL)
+		actl_channel_select(channel);
+	else if(m_channel_names != NULL)
+		actl_channel_select((const gchar *)m_channel_names->data);
+
+	return TRUE;
+}
+
+void actl_reload_config()
+{
+	int volume = m_state.volume;
+	actl_check_curve();
+	if(m_state.volume != volume)
+		m_volume_changed(actl_get_volume(), actl_get_mute());
+}
+
+void actl_set_channel(const gchar *channel)
+{
+	if(m_hctl == NULL || channel == NULL) {
+		return;
+	}
+	if(actl_channel_select(channel))
+		m_volume_changed(actl_get_volume(), actl_get_mute());
+}
+
+void actl_set_mute(gboolean mute)
+{
+	if(m_active == NULL) {
+		return;
+	}
+
+	if(m_active->sw) {
+		actl_write_switch(!mute);
+		actl_state_refresh();
+	}
+	else if(mute) {
+		actl_set_volume(0);
+	}
+}
+
+void actl_set_volume(int volume)
+{
+	if(m_active == NULL) {
+		return;
+	}
+	volume = (volume < 0 ? 0 : (volume > 100 ? 100 : volume));
+
+	actl_check_curve();
+	actl_write_volume(volume);
+	actl_state_refresh();
+}
+
+// Only the controls which change are written. Muting happens before and
+// unmuting after the volume change, so the step in between isn't heard.
+void actl_set_state(int volume, gboolean mute)
+{
+	if(m_active == NULL) {
+		return;
+	}
+	volume = (volume < 0 ? 0 : (volume > 100 ? 100 : volume));
+	if(m_active->sw == NULL) {
+		actl_set_volume(mute ? 0 : volume);
+		return;
+	}
+
+	actl_check_curve();
+	if(mute && !m_state.mute)
+		actl_write_switch(FALSE);
+	if(volume != m_state.volume)
+		actl_write_volume(volume);
+	if(!mute && m_state.mute)
+		actl_write_switch(TRUE);
+	actl_state_refresh();
+}
@@ -28,6 +28,12 @@
  *
  * When setting the volume, 'dir' is the rounding direction:
  * -1/0/1 = down/nearest/up.
+ *
+ * The volume_table functions precompute a mapping for the volumes 0..100 so
+ * that getting and setting the volume doesn't need any floating point math.
+ * Besides the mapping above (VOLUME_CURVE_ALSAMIXER) they support a linear
+ * mapping of the raw register values and a plain cubic mapping of the dB
+ * values which doesn't special-case small ranges.
  */
 
 #define _ISOC99_SOURCE /* lrint() */
@@ -218,3 +224,141 @@ int set_normalized_capture_volume_all(snd_mixer_elem_t *elem,
 }
 
 
+
+static double volume_table_position(int i)
+{
+	return i / (double)(VOLUME_TABLE_SIZE - 1);
+}
+
+static void volume_table_init_raw(struct volume_table *table,
+				  long min, long max)
+{
+	int i;
+
+	table->use_dB = false;
+	for (i = 0; i < VOLUME_TABLE_SIZE; i++)
+		table->values[i] = lrint(volume_table_position(i) * (max - min)) + min;
+}
+
+static void volume_table_init_dB(struct volume_table *table,
+				 long min, long max, bool rescale)
+{
+	double position, min_norm = 0;
+	long value;
+	int i;
+
+	table->use_dB = true;
+	if (rescale && min != SND_CTL_TLV_DB_GAIN_MUTE)
+		min_norm = exp10((min - max) / 6000.0);
+	for (i = 0; i < VOLUME_TABLE_SIZE; i++) {
+		position = volume_table_position(i);
+		position = position * (1 - min_norm) + min_norm;
+		if (position <= 0) {
+			table->values[i] = min;
+			continue;
+		}
+		value = lrint(6000.0 * log10(position)) + max;
+		table->values[i] = value < min ? min : value;
+	}
+}
+
+/*
+ * Fills the table from ranges the caller already knows, for controls that are
+ * not accessed through the simple mixer API.  'dB_valid' is false if the
+ * control has no dB information.
+ */
+void volume_table_init_ranges(struct volume_table *table,
+			      enum volume_curve curve,
+			      long min, long max,
+			      long dBmin, long dBmax, bool dB_valid)
+{
+	int i;
+
+	table->curve = curve;
+
+	if (curve == VOLUME_CURVE_LINEAR || !dB_valid || dBmin >= dBmax) {
+		volume_table_init_raw(table, min, max);
+		return;
+	}
+
+	if (curve == VOLUME_CURVE_ALSAMIXER && use_linear_dB_scale(dBmin, dBmax)) {
+		table->use_dB = true;
+		for (i = 0; i < VOLUME_TABLE_SIZE; i++)
+			table->values[i] =
+				lrint(volume_table_position(i) * (dBmax - dBmin)) + dBmin;
+		return;
+	}
+
+	volume_table_init_dB(table, dBmin, dBmax, curve == VOLUME_CURVE_ALSAMIXER);
+}
+
+int volume_table_init(struct volume_table *table,
+		      snd_mixer_elem_t *elem,
+		      enum volume_curve curve)
+{
+	long min = 0, max = 0, dBmin = 0, dBmax = 0;
+	bool dB_valid;
+	int err;
+
+	err = curve == VOLUME_CURVE_LINEAR ? -1 :
+		snd_mixer_selem_get_playback_dB_range(elem, &dBmin, &dBmax);
+	dB_valid = err >= 0 && dBmin < dBmax;
+	if (!dB_valid) {
+		err = snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
+		if (err < 0)
+			min = max = 0;
+	}
+
+	volume_table_init_ranges(table, curve, min, max, dBmin, dBmax, dB_valid);
+	return dB_valid ? 0 : err;
+}
+
+/*
+ * Returns the volume whose table entry is closest to 'value'.  Several volumes
+ * can share an entry when the control has fewer steps than the table; the
+ * lowest of them is returned unless they include the maximum volume.
+ */
+int volume_table_lookup(const struct volume_table *table, long value)
+{
+	int low = 0, high = VOLUME_TABLE_SIZE, mid, last;
+
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (table->values[mid] < value)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low == VOLUME_TABLE_SIZE)
+		return VOLUME_TABLE_SIZE - 1;
+	if (table->values[low] == value) {
+		last = low;
+		while (last < VOLUME_TABLE_SIZE - 1 &&
+		       table->values[last + 1] == value)
+			last++;
+		return last == VOLUME_TABLE_SIZE - 1 ? last : low;
+	}
+	if (low == 0)
+		return 0;
+	if (value - table->values[low - 1] <= table->values[low] - value)
+		return low - 1;
+	return low;
+}
+
+int volume_table_set_playback_volume_all(const struct volume_table *table,
+					 snd_mixer_elem_t *elem,
+					 int volume)
+{
+	long value;
+
+	if (volume < 0)
+		volume = 0;
+	else if (volume >= VOLUME_TABLE_SIZE)
+		volume = VOLUME_TABLE_SIZE - 1;
+	value = table->values[volume];
+
+	if (table->use_dB)
+		return snd_mixer_selem_set_playback_dB_all(elem, value, 0);
+	return snd_mixer_selem_set_playback_volume_all(elem, value);
+}
@@ -2,6 +2,26 @@
 #define VOLUME_MAPPING_H_INCLUDED
 
 #include <alsa/asoundlib.h>
+#include <stdbool.h>
+
+#define VOLUME_TABLE_SIZE 101
+
+enum volume_curve {
+	VOLUME_CURVE_ALSAMIXER,
+	VOLUME_CURVE_LINEAR,
+	VOLUME_CURVE_CUBIC,
+	VOLUME_CURVE_COUNT
+};
+
+/*
+ * Maps the volumes 0..100 onto dB values (in 0.01 dB) or, for controls without
+ * dB information and for the linear curve, onto raw volume register values.
+ */
+struct volume_table {
+	enum volume_curve curve;
+	bool use_dB;
+	long values[VOLUME_TABLE_SIZE];
+};
 
 double get_normalized_playback_volume(snd_mixer_elem_t *elem,
 				      snd_mixer_selem_channel_id_t channel);
@@ -21,5 +41,16 @@ int set_normalized_capture_volume(snd_mixer_elem_t *elem,
 int set_normalized_capture_volume_all(snd_mixer_elem_t *elem,
 				  double volume,
 				  int dir);
+void volume_table_init_ranges(struct volume_table *table,
+			      enum volume_curve curve,
+			      long min, long max,
+			      long dBmin, long dBmax, bool dB_valid);
+int volume_table_init(struct volume_table *table,
+		      snd_mixer_elem_t *elem,
+		      enum volume_curve curve);
+int volume_table_lookup(const struct volume_table *table, long value);
+int volume_table_set_playback_volume_all(const struct volume_table *table,
+					 snd_mixer_elem_t *elem,
+					 int volume);
 
 #endif
@@ -0,0 +1,228 @@
+//##############################################################################
+// volumeicon
+//
+// backend.c - registry of the sound backends volumeicon was built with
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+#include <glib.h>
+
+#include "backend.h"
+#ifdef COMPILEWITH_ALSA
+#include "alsa_backend.h"
+#include "alsa_ctl_backend.h"
+#endif
+#ifdef COMPILEWITH_OSS
+#include "oss_backend.h"
+#endif
+#ifdef COMPILEWITH_PULSE
+#include "pulse_backend.h"
+#endif
+#ifdef COMPILEWITH_MOCK
+#include "mock_backend.h"
+#endif
+
+//##############################################################################
+// Static variables
+//##############################################################################
+#ifdef COMPILEWITH_ALSA
+static const Backend m_alsa_backend = {
+    asound_get_volume,
+    asound_get_mute,
+    asound_set_volume,
+    asound_set_mute,
+    asound_set_state,
+    asound_setup,
+    asound_set_channel,
+    asound_get_channel,
+    asound_get_channel_names,
+    asound_load_channels,
+    asound_get_device,
+    asound_get_device_names,
+    asound_watch_devices,
+    asound_reload_config,
+    asound_print_diagnostics,
+    asound_close,
+    asound_probe,
+    "alsa",
+    BACKEND_CAP_DEVICES | BACKEND_CAP_DIAGNOSTICS,
+    "/dev/snd",
+    "controlC"};
+
+static const Backend m_alsa_ctl_backend = {
+    actl_get_volume,
+    actl_get_mute,
+    actl_set_volume,
+    actl_set_mute,
+    actl_set_state,
+    actl_setup,
+    actl_set_channel,
+    actl_get_channel,
+    actl_get_channel_names,
+    NULL,
+    actl_get_device,
+    actl_get_device_names,
+    NULL,
+    actl_reload_config,
+    NULL,
+    NULL,
+    NULL,
+    "alsa-ctl",
+    BACKEND_CAP_DEVICES,
+    "/dev/snd",
+    "controlC"};
+#endif
+
+#ifdef COMPILEWITH_OSS
+static const Backend m_oss_backend = {
+    oss_get_volume,
+    oss_get_mute,
+    oss_set_volume,
+    oss_set_mute,
+    oss_set_state,
+    oss_setup,
+    oss_set_channel,
+    oss_get_channel,
+    oss_get_channel_names,
+    NULL,
+    oss_get_device,
+    oss_get_device_names,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    oss_probe,
+    "oss",
+    BACKEND_CAP_DEVICES,
+    "/dev",
+    "mixer"};
+#endif
+
+#ifdef COMPILEWITH_PULSE
+static const Backend m_pulse_backend = {
+    pulse_get_volume,
+    pulse_get_mute,
+    pulse_set_volume,
+    pulse_set_mute,
+    pulse_set_state,
+    pulse_setup,
+    pulse_set_channel,
+    pulse_get_channel,
+    pulse_get_channel_names,
+    NULL,
+    pulse_get_device,
+    pulse_get_device_names,
+    pulse_watch_devices,
+    NULL,
+    NULL,
+    pulse_close,
+    pulse_probe,
+    "pulse",
+    BACKEND_CAP_DEVICES | BACKEND_CAP_BOOST,
+    NULL,
+    NULL};
+#endif
+
+#ifdef COMPILEWITH_MOCK
+static const Backend m_mock_backend = {
+    mock_get_volume,
+    mock_get_mute,
+    mock_set_volume,
+    mock_set_mute,
+    mock_set_state,
+    mock_setup,
+    mock_set_channel,
+    mock_get_channel,
+    mock_get_channel_names,
+    NULL,
+    mock_get_device,
+    mock_get_device_names,
+    NULL,
+    NULL,
+    mock_print_diagnostics,
+    NULL,
+    NULL,
+    "mock",
+    BACKEND_CAP_DEVICES | BACKEND_CAP_DIAGNOSTICS,
+    NULL,
+    NULL};
+#endif
+
+// In order of preference when probing
+static const Backend *const m_backends[] = {
+#ifdef COMPILEWITH_PULSE
+    &m_pulse_backend,
+#endif
+#ifdef COMPILEWITH_ALSA
+    &m_alsa_backend,
+#endif
+#ifdef COMPILEWITH_OSS
+    &m_oss_backend,
+#endif
+#ifdef COMPILEWITH_ALSA
+    &m_alsa_ctl_backend,
+#endif
+#ifdef COMPILEWITH_MOCK
+    &m_mock_backend,
+#endif
+    NULL};
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+const Backend *backend_find(const gchar *name)
+{
+	int i;
+	for(i = 0; m_backends[i] != NULL; i++) {
+		if(g_strcmp0(m_backends[i]->name, name) == 0)
+			return m_backends[i];
+	}
+	return NULL;
+}
+
+// Returns the first backend which works on this system. If none does the
+// first one with a probe is returned anyway, its device might still show up
+// through hotplug. NULL only if no backend was compiled in.
+const Backend *backend_probe(void)
+{
+	const Backend *fallback = NULL;
+	int i;
+	for(i = 0; m_backends[i] != NULL; i++) {
+		if(m_backends[i]->probe == NULL)
+			continue;
+		if(m_backends[i]->probe())
+			return m_backends[i];
+		if(fallback == NULL)
+			fallback = m_backends[i];
+	}
+	return fallback ? fallback : m_backends[0];
+}
+
+// Returns the names of all backends separated by commas
+gchar *backend_get_names(void)
+{
+	GString *names = g_string_new(NULL);
+	int i;
+	for(i = 0; m_backends[i] != NULL; i++) {
+		if(i > 0)
+			g_string_append(names, ", ");
+		g_string_append(names, m_backends[i]->name);
+	}
+	return g_string_free(names, FALSE);
+}
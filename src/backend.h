@@ -0,0 +1,96 @@
+//##############################################################################
+// volumeicon
+//
+// backend.h - describes the sound backends volumeicon can use
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+#include <glib.h>
+
+// What a backend can do besides getting and setting the volume
+enum {
+	BACKEND_CAP_DEVICES = 1 << 0, // lists devices and can switch between them
+	BACKEND_CAP_DIAGNOSTICS = 1 << 1, // has counters for print_diagnostics
+	BACKEND_CAP_BOOST = 1 << 2 // volumes go up to BACKEND_VOLUME_BOOST_MAX
+};
+
+// Highest volume in percent of a backend with BACKEND_CAP_BOOST, the
+// volume control of pavucontrol goes just as far
+#define BACKEND_VOLUME_BOOST_MAX 150
+
+typedef struct {
+	// Called on every volume change, so they come first
+	int (*get_volume)(void);
+	gboolean (*get_mute)(void);
+	void (*set_volume)(int volume);
+	void (*set_mute)(gboolean mute);
+	// Sets both at once, with as few writes as the device allows
+	void (*set_state)(int volume, gboolean mute);
+
+	// Setup might finish in the background, volume_changed is run once the
+	// state is known. It's also run with the state of a channel switched to
+	// by set_channel, the getters can lag behind until then.
+	gboolean (*setup)(const gchar *card, const gchar *channel,
+	                  void (*volume_changed)(int, gboolean));
+	void (*set_channel)(const gchar *channel);
+	const gchar *(*get_channel)(void);
+	const GList *(*get_channel_names)(void);
+	// Setup might only list the channel it was asked for. Once this is
+	// called all of them are listed, the watch_devices callback tells when
+	// they are there. NULL if get_channel_names always lists all of them.
+	void (*load_channels)(void);
+	const gchar *(*get_device)(void);
+	const GList *(*get_device_names)(void);
+	// The callback is run whenever get_device_names or get_channel_names
+	// has more to tell. NULL if the lists are complete as soon as setup
+	// returns.
+	void (*watch_devices)(void (*devices_changed)(void));
+	// Picks up changes of the config the backend reads, like the volume
+	// scale, and reports a changed volume through volume_changed. NULL if
+	// the backend doesn't read the config.
+	void (*reload_config)(void);
+	void (*print_diagnostics)(void);
+	// Called before exiting, waits a bounded time for writes which haven't
+	// reached the device yet. NULL if writes are done when they return.
+	void (*close)(void);
+
+	// Tells if the backend should work on this system, NULL if it's only
+	// used when asked for by name.
+	gboolean (*probe)(void);
+
+	const gchar *name;
+	guint caps;
+
+	// Setup is redone when a device node starting with hotplug_prefix shows
+	// up in or disappears from hotplug_dir. NULL if there is nothing to watch.
+	const gchar *hotplug_dir;
+	const gchar *hotplug_prefix;
+} Backend;
+
+const Backend *backend_find(const gchar *name);
+// The first backend whose probe succeeds. If none does the first one with a
+// probe, setup is then redone once its device shows up. NULL only if no
+// backend was compiled in.
+const Backend *backend_probe(void);
+gchar *backend_get_names(void);
+
+#endif
@@ -31,6 +31,8 @@
 //##############################################################################
 #define CONFIG_DIRNAME "volumeicon"
 #define CONFIG_FILENAME "volumeicon"
+#define WRITE_INTERVAL_MIN 1
+#define WRITE_INTERVAL_MAX 1000
 
 //##############################################################################
 // Static variables
@@ -39,9 +41,12 @@ static struct config {
 	gchar *path;
 
 	// Alsa
+	gchar *backend;
 	gchar *card; // TODO: Rename this to device.
 	gchar *channel;
 	gboolean logarithmic_scale;
+	gint volume_curve;
+	int write_interval;
 
 	// Notifications
 	gboolean show_notification;
@@ -75,9 +80,12 @@ static struct config {
 } m_config = {.path = NULL,
 
               // Alsa
+              .backend = NULL,
               .card = NULL,
               .channel = NULL,
               .logarithmic_scale = FALSE,
+              .volume_curve = 0,
+              .write_interval = 0,
 
               // Notifications
               .show_notification = TRUE,
@@ -120,6 +128,8 @@ static void config_load_default(void)
 		config_set_channel(NULL);
 	if(!m_config.card)
 		config_set_card("default");
+	if(!m_config.write_interval)
+		config_set_write_interval(16);
 	if(!m_config.stepsize)
 		config_set_stepsize(5);
 	if(!m_config.theme)
@@ -137,6 +147,7 @@ static void config_read(void)
 	// Clean up previously loaded configuration values
 	m_config.stepsize = 0;
 	g_free(m_config.helper_program);
+	g_free(m_config.backend);
 	g_free(m_config.channel);
 	g_free(m_config.theme);
 
@@ -151,9 +162,14 @@ static void config_read(void)
 #define GET_INT(s, k) GET_VALUE(integer, s, k)
 
 	// Alsa
+	m_config.backend = GET_STRING("Alsa", "backend");
 	m_config.card = GET_STRING("Alsa", "card");
 	m_config.channel = GET_STRING("Alsa", "channel");
 	m_config.logarithmic_scale = GET_BOOL("Alsa", "logarithmic_scale");
+	m_config.volume_curve = GET_INT("Alsa", "volume_curve");
+	m_config.write_interval = GET_INT("Alsa", "write_interval");
+	if(m_config.write_interval)
+		config_set_write_interval(m_config.write_interval);
 
 	// Notifications
 	m_config.show_notification = GET_BOOL("Notification", "show_notification");
@@ -222,6 +238,15 @@ void config_set_use_logarithmic_scale(gboolean logarithmic_scale)
 	m_config.logarithmic_scale = logarithmic_scale;
 }
 
+void config_set_volume_curve(gint curve) { m_config.volume_curve = curve; }
+
+void config_set_write_interval(int write_interval)
+{
+	// It ends up as the interval of a timeout, which takes a guint
+	m_config.write_interval =
+	    CLAMP(write_interval, WRITE_INTERVAL_MIN, WRITE_INTERVAL_MAX);
+}
+
 // Notifications
 void config_set_show_notification(gboolean active)
 {
@@ -325,6 +350,8 @@ void config_set_hotkey_mute(const gchar *mute)
 //##############################################################################
 
 // Alsa
+const gchar *config_get_backend(void) { return m_config.backend; }
+
 const gchar *config_get_card(void) { return m_config.card; }
 
 const gchar *config_get_channel(void) { return m_config.channel; }
@@ -334,6 +361,10 @@ gboolean config_get_use_logarithmic_scale()
 	return m_config.logarithmic_scale;
 }
 
+gint config_get_volume_curve(void) { return m_config.volume_curve; }
+
+int config_get_write_interval(void) { return m_config.write_interval; }
+
 // Notifications
 gboolean config_get_show_notification(void)
 {
@@ -354,6 +385,11 @@ gboolean config_get_use_gtk_theme(void)
 	return g_strcmp0(m_config.theme, "Default") == 0 ? TRUE : FALSE;
 }
 
+gboolean config_get_use_level_theme(void)
+{
+	return g_strcmp0(m_config.theme, THEME_LEVEL) == 0 ? TRUE : FALSE;
+}
+
 gboolean config_get_use_panel_specific_icons(void)
 {
 	return m_config.use_panel_specific_icons;
@@ -424,11 +460,15 @@ void config_write(void)
 #define SET_INT(s, k, v) SET_VALUE(integer, s, k, v)
 
 	// Alsa
+	if(m_config.backend)
+		SET_STRING("Alsa", "backend", m_config.backend);
 	if(m_config.card)
 		SET_STRING("Alsa", "card", m_config.card);
 	if(m_config.channel)
 		SET_STRING("Alsa", "channel", m_config.channel);
 	SET_BOOL("Alsa", "logarithmic_scale", m_config.logarithmic_scale);
+	SET_INT("Alsa", "volume_curve", m_config.volume_curve);
+	SET_INT("Alsa", "write_interval", m_config.write_interval);
 
 	// Notifications
 	SET_BOOL("Notification", "show_notification", m_config.show_notification);
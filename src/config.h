@@ -24,6 +24,15 @@
 #ifndef __CONFIG_H__
 #define __CONFIG_H__
 
+// The theme that draws the volume as a bar. A slash can't be part of a
+// directory name, so no icon theme in ICONS_DIR can have this name.
+#define THEME_LEVEL "/level"
+
+// Values of the volume_curve setting the preferences can pick, 1 is the same
+// as logarithmic_scale
+#define CONFIG_VOLUME_CURVE_ALSAMIXER 0
+#define CONFIG_VOLUME_CURVE_CUBIC 2
+
 //##############################################################################
 // Setter functions
 //##############################################################################
@@ -32,6 +41,8 @@
 void config_set_card(const gchar *card);
 void config_set_channel(const gchar *channel);
 void config_set_use_logarithmic_scale(gboolean use_logarithmic_scale);
+void config_set_volume_curve(gint curve);
+void config_set_write_interval(int write_interval);
 
 // Notifications
 void config_set_show_notification(gboolean active);
@@ -68,9 +79,12 @@ void config_set_hotkey_mute(const gchar *mute);
 //##############################################################################
 
 // Alsa
+const gchar *config_get_backend(void);
 const gchar *config_get_card(void);
 const gchar *config_get_channel(void);
 gboolean config_get_use_logarithmic_scale(void);
+gint config_get_volume_curve(void);
+int config_get_write_interval(void);
 
 // Notifications
 gboolean config_get_show_notification(void);
@@ -81,6 +95,7 @@ int config_get_stepsize(void);
 const gchar *config_get_helper(void);
 const gchar *config_get_theme(void);
 gboolean config_get_use_gtk_theme(void);
+gboolean config_get_use_level_theme(void);
 gboolean config_get_use_panel_specific_icons(void);
 gboolean config_get_reverse_scroll_direction(void);
 
@@ -0,0 +1,72 @@
+//##############################################################################
+// volumeicon
+//
+// level_icon.c - draws the status icon of the Level theme
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+#include <gtk/gtk.h>
+
+#include "level_icon.h"
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+// Draws a bar filled up to the volume, greyed out and crossed when muted
+GdkPixbuf *level_icon_render(int volume, gboolean mute, gint size)
+{
+	cairo_surface_t *surface =
+	    cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
+	cairo_t *cr = cairo_create(surface);
+
+	double width = MAX(2.0, size / 2.0);
+	double height = size - MAX(2.0, size / 8.0) * 2;
+	double x = (size - width) / 2;
+	double y = (size - height) / 2;
+	double level = height * volume / 100.0;
+
+	cairo_rectangle(cr, x, y, width, height);
+	cairo_set_source_rgba(cr, 0.5, 0.5, 0.5, 0.35);
+	cairo_fill(cr);
+
+	cairo_rectangle(cr, x, y + height - level, width, level);
+	if(mute)
+		cairo_set_source_rgba(cr, 0.6, 0.6, 0.6, 0.9);
+	else
+		cairo_set_source_rgba(cr, 0.3, 0.6, 0.9, 1.0);
+	cairo_fill(cr);
+
+	cairo_set_line_width(cr, MAX(1.0, size / 16.0));
+	cairo_rectangle(cr, x, y, width, height);
+	cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.6);
+	cairo_stroke(cr);
+
+	if(mute) {
+		cairo_set_line_width(cr, MAX(1.0, size / 8.0));
+		cairo_move_to(cr, x - width / 4, y);
+		cairo_line_to(cr, x + width * 5 / 4, y + height);
+		cairo_set_source_rgba(cr, 0.8, 0.1, 0.1, 1.0);
+		cairo_stroke(cr);
+	}
+
+	cairo_destroy(cr);
+	GdkPixbuf *pixbuf = gdk_pixbuf_get_from_surface(surface, 0, 0, size, size);
+	cairo_surface_destroy(surface);
+	return pixbuf;
+}
@@ -0,0 +1,32 @@
+//##############################################################################
+// volumeicon
+//
+// level_icon.h - draws the status icon of the Level theme
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+#ifndef __LEVEL_ICON_H__
+#define __LEVEL_ICON_H__
+
+#include <gtk/gtk.h>
+
+// Draws the icon for volume in percent at size x size pixels
+GdkPixbuf *level_icon_render(int volume, gboolean mute, gint size);
+
+#endif
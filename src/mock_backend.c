@@ -0,0 +1,460 @@
+//##############################################################################
+// volumeicon
+//
+// mock_backend.c - implements a volume control abstraction on top of mixers
+//                  that only exist in memory
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+#include <glib.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mock_backend.h"
+
+//##############################################################################
+// Definitions
+//##############################################################################
+// The layout is read from the key file this variable points to. Every group
+// except the script one describes a channel and is named "device/channel":
+//
+//   [default/Master]
+//   min_dB=-64.0
+//   max_dB=0.0
+//   resolution=0.5
+//   volume=60
+//   has_mute=true
+//   mute=false
+//
+//   [Script]
+//   events=500 volume 30;250 mute 1;250 volume 80 PCM
+//   repeat=true
+//
+// Every event waits the given number of milliseconds after the previous one
+// and then sets the volume or mute of the named channel, or of the current
+// one if no channel is given.
+#define MOCK_LAYOUT_ENV "VOLUMEICON_MOCK"
+#define MOCK_SCRIPT_GROUP "Script"
+#define MOCK_DEFAULT_DEVICE "default"
+
+//##############################################################################
+// Type definitions
+//##############################################################################
+typedef struct {
+	gchar *name;
+	double min_dB;
+	double max_dB;
+	double resolution; // size of one step in dB, 0 for no steps
+	double dB;
+	gboolean has_mute;
+	gboolean mute;
+} MockChannel;
+
+typedef struct {
+	guint delay;
+	gboolean is_mute;
+	int value;
+	gchar *channel;
+} MockEvent;
+
+//##############################################################################
+// Static variables
+//##############################################################################
+static GHashTable *m_layout = NULL; // device name -> GList of MockChannel
+static GList *m_device_names = NULL;
+static GList *m_channel_names = NULL;
+static gchar *m_device = NULL;
+static gchar *m_channel = NULL;
+static GList *m_channels = NULL;
+static MockChannel *m_current = NULL;
+static void (*m_volume_changed)(int, gboolean) = NULL;
+
+static GPtrArray *m_script = NULL;
+static guint m_script_pos = 0;
+static guint m_script_id = 0;
+static gboolean m_script_repeat = FALSE;
+
+static guint m_volume_writes = 0;
+static guint m_mute_writes = 0;
+static guint m_state_writes = 0;
+static guint m_events_fired = 0;
+static guint m_callbacks = 0;
+
+//##############################################################################
+// Static functions
+//##############################################################################
+static MockChannel *channel_new(const gchar *name, double min_dB,
+                                double max_dB, double resolution, int volume,
+                                gboolean has_mute, gboolean mute)
+{
+	MockChannel *channel = g_new0(MockChannel, 1);
+	channel->name = g_strdup(name);
+	channel->min_dB = min_dB;
+	channel->max_dB = max_dB > min_dB ? max_dB : min_dB + 1.0;
+	channel->resolution = resolution > 0.0 ? resolution : 0.0;
+	channel->has_mute = has_mute;
+	channel->mute = has_mute && mute;
+
+	volume = (volume < 0 ? 0 : (volume > 100 ? 100 : volume));
+	channel->dB = channel->min_dB +
+	              (channel->max_dB - channel->min_dB) * volume / 100.0;
+	return channel;
+}
+
+static void channel_free(gpointer data)
+{
+	MockChannel *channel = (MockChannel *)data;
+	g_free(channel->name);
+	g_free(channel);
+}
+
+static void channel_list_free(gpointer data)
+{
+	g_list_free_full((GList *)data, channel_free);
+}
+
+static int channel_get_volume(const MockChannel *channel)
+{
+	double range = channel->max_dB - channel->min_dB;
+	return (int)lround(100.0 * (channel->dB - channel->min_dB) / range);
+}
+
+// Like a real mixer the level can only take one of the steps of the channel
+static void channel_set_volume(MockChannel *channel, int volume)
+{
+	volume = (volume < 0 ? 0 : (volume > 100 ? 100 : volume));
+	double range = channel->max_dB - channel->min_dB;
+	double dB = range * volume / 100.0;
+	if(channel->resolution > 0.0)
+		dB = floor(dB / channel->resolution + 0.5) * channel->resolution;
+	channel->dB = MIN(channel->min_dB + dB, channel->max_dB);
+}
+
+static void channel_set_mute(MockChannel *channel, gboolean mute)
+{
+	if(channel->has_mute)
+		channel->mute = mute;
+	// Without a mute switch muting means turning it all the way down
+	else if(mute)
+		channel_set_volume(channel, 0);
+}
+
+static void layout_add(const gchar *device, MockChannel *channel)
+{
+	// The list is stolen and put back so its free function isn't called
+	gpointer key, channels;
+	if(g_hash_table_lookup_extended(m_layout, device, &key, &channels)) {
+		g_hash_table_steal(m_layout, device);
+		g_hash_table_insert(m_layout, key, g_list_append(channels, channel));
+		return;
+	}
+	m_device_names = g_list_append(m_device_names, (gpointer)g_strdup(device));
+	g_hash_table_insert(m_layout, g_strdup(device),
+	                    g_list_append(NULL, channel));
+}
+
+static void layout_load_default()
+{
+	layout_add(MOCK_DEFAULT_DEVICE,
+	           channel_new("Master", -65.25, 0.0, 0.75, 60, TRUE, FALSE));
+	layout_add(MOCK_DEFAULT_DEVICE,
+	           channel_new("PCM", -51.0, 0.0, 0.5, 100, FALSE, FALSE));
+	layout_add(MOCK_DEFAULT_DEVICE,
+	           channel_new("Headphone", -65.25, 0.0, 0.75, 0, TRUE, TRUE));
+	layout_add("USB", channel_new("Speaker", -37.0, 0.0, 1.0, 40, TRUE, FALSE));
+}
+
+static void script_free(gpointer data)
+{
+	MockEvent *event = (MockEvent *)data;
+	g_free(event->channel);
+	g_free(event);
+}
+
+// Events look like "DELAY volume|mute VALUE [CHANNEL]"
+static void script_load(GKeyFile *kf)
+{
+	gchar **events = g_key_file_get_string_list(kf, MOCK_SCRIPT_GROUP,
+	                                            "events", NULL, NULL);
+	m_script_repeat =
+	    g_key_file_get_boolean(kf, MOCK_SCRIPT_GROUP, "repeat", NULL);
+	if(events == NULL)
+		return;
+
+	int i;
+	for(i = 0; events[i] != NULL; i++) {
+		gchar **fields = g_strsplit_set(g_strstrip(events[i]), " \t", 4);
+		guint count = g_strv_length(fields);
+		if(count < 3 || (strcmp(fields[1], "volume") != 0 &&
+		                 strcmp(fields[1], "mute") != 0)) {
+			fprintf(stderr, "Ignoring mock event \"%s\"\n", events[i]);
+			g_strfreev(fields);
+			continue;
+		}
+		MockEvent *event = g_new0(MockEvent, 1);
+		event->delay = (guint)strtoul(fields[0], NULL, 10);
+		event->is_mute = strcmp(fields[1], "mute") == 0;
+		event->value = atoi(fields[2]);
+		event->channel = count > 3 ? g_strdup(fields[3]) : NULL;
+		g_ptr_array_add(m_script, event);
+		g_strfreev(fields);
+	}
+	g_strfreev(events);
+}
+
+static void layout_load()
+{
+	m_layout = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                 channel_list_free);
+	m_script = g_ptr_array_new_with_free_func(script_free);
+
+	const gchar *path = getenv(MOCK_LAYOUT_ENV);
+	if(path == NULL) {
+		layout_load_default();
+		return;
+	}
+
+	GKeyFile *kf = g_key_file_new();
+	GError *error = NULL;
+	if(!g_key_file_load_from_file(kf, path, G_KEY_FILE_NONE, &error)) {
+		fprintf(stderr, "Failed to load mock layout %s: %s\n", path,
+		        error->message);
+		g_error_free(error);
+		g_key_file_free(kf);
+		layout_load_default();
+		return;
+	}
+
+	gchar **groups = g_key_file_get_groups(kf, NULL);
+	int i;
+	for(i = 0; groups[i] != NULL; i++) {
+		if(strcmp(groups[i], MOCK_SCRIPT_GROUP) == 0)
+			continue;
+
+		// Channels without a device belong to the default one
+		const gchar *name = groups[i];
+		gchar *device = g_strdup(MOCK_DEFAULT_DEVICE);
+		gchar *separator = strchr(groups[i], '/');
+		if(separator) {
+			g_free(device);
+			device = g_strndup(groups[i], separator - groups[i]);
+			name = separator + 1;
+		}
+
+		double min_dB = g_key_file_get_double(kf, groups[i], "min_dB", NULL);
+		double max_dB = g_key_file_get_double(kf, groups[i], "max_dB", NULL);
+		double resolution =
+		    g_key_file_get_double(kf, groups[i], "resolution", NULL);
+		int volume = g_key_file_get_integer(kf, groups[i], "volume", NULL);
+		gboolean has_mute =
+		    g_key_file_get_boolean(kf, groups[i], "has_mute", NULL);
+		gboolean mute = g_key_file_get_boolean(kf, groups[i], "mute", NULL);
+		layout_add(device, channel_new(name, min_dB, max_dB, resolution,
+		                               volume, has_mute, mute));
+		g_free(device);
+	}
+	g_strfreev(groups);
+
+	script_load(kf);
+	g_key_file_free(kf);
+
+	if(m_device_names == NULL) {
+		fprintf(stderr, "No channels in mock layout %s\n", path);
+		layout_load_default();
+	}
+}
+
+static MockChannel *channel_find(const gchar *name)
+{
+	GList *iter;
+	for(iter = m_channels; iter != NULL; iter = g_list_next(iter)) {
+		MockChannel *channel = (MockChannel *)iter->data;
+		if(g_strcmp0(channel->name, name) == 0)
+			return channel;
+	}
+	return NULL;
+}
+
+static void notify()
+{
+	if(m_volume_changed == NULL)
+		return;
+	m_callbacks++;
+	m_volume_changed(mock_get_volume(), mock_get_mute());
+}
+
+static gboolean script_cb(gpointer data)
+{
+	MockEvent *event = g_ptr_array_index(m_script, m_script_pos);
+	m_events_fired++;
+
+	// Events for channels of other devices have nothing to change
+	MockChannel *channel = event->channel ? channel_find(event->channel)
+	                                      : m_current;
+	if(channel) {
+		int volume = channel_get_volume(channel);
+		gboolean mute = channel->mute;
+		if(event->is_mute)
+			channel_set_mute(channel, event->value != 0);
+		else
+			channel_set_volume(channel, event->value);
+		if(channel == m_current &&
+		   (volume != channel_get_volume(channel) || mute != channel->mute))
+			notify();
+	}
+
+	m_script_pos++;
+	if(m_script_pos >= m_script->len) {
+		m_script_pos = 0;
+		if(!m_script_repeat) {
+			m_script_id = 0;
+			return FALSE;
+		}
+	}
+	event = g_ptr_array_index(m_script, m_script_pos);
+	m_script_id = g_timeout_add(event->delay, script_cb, NULL);
+	return FALSE;
+}
+
+// Returns FALSE if the channel is already selected or doesn't exist
+static gboolean channel_select(const gchar *channel)
+{
+	if(channel == NULL || g_strcmp0(channel, m_channel) == 0)
+		return FALSE;
+	MockChannel *found = channel_find(channel);
+	if(found == NULL)
+		return FALSE;
+
+	g_free(m_channel);
+	m_channel = g_strdup(channel);
+	m_current = found;
+	return TRUE;
+}
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+const gchar *mock_get_channel() { return m_channel; }
+
+const gchar *mock_get_device() { return m_device; }
+
+const GList *mock_get_channel_names() { return m_channel_names; }
+
+const GList *mock_get_device_names() { return m_device_names; }
+
+int mock_get_volume()
+{
+	return m_current ? channel_get_volume(m_current) : 0;
+}
+
+// Without a channel nothing can be heard, like with the ALSA backend
+gboolean mock_get_mute() { return m_current ? m_current->mute : TRUE; }
+
+gboolean mock_setup(const gchar *card, const gchar *channel,
+                    void (*volume_changed)(int, gboolean))
+{
+	// The levels are kept across setups, like those of a real card
+	if(m_layout == NULL)
+		layout_load();
+
+	// Clean up resources from previous calls to setup
+	g_free(m_channel);
+	m_channel = NULL;
+	g_list_free(m_channel_names);
+	m_channel_names = NULL;
+	m_current = NULL;
+
+	g_free(m_device);
+	m_device = g_strdup(card ? card : MOCK_DEFAULT_DEVICE);
+	m_volume_changed = volume_changed;
+
+	m_channels = g_hash_table_lookup(m_layout, m_device);
+	if(m_channels == NULL) {
+		fprintf(stderr, "No mock device %s\n", m_device);
+		return FALSE;
+	}
+
+	GList *iter;
+	for(iter = m_channels; iter != NULL; iter = g_list_next(iter)) {
+		m_channel_names = g_list_append(
+		    m_channel_names, (gpointer)((MockChannel *)iter->data)->name);
+	}
+
+	if(channel != NULL && channel_find(channel) != NULL)
+		channel_select(channel);
+	else
+		channel_select((const gchar *)m_channel_names->data);
+
+	if(m_script->len > 0 && m_script_id == 0) {
+		MockEvent *event = g_ptr_array_index(m_script, m_script_pos);
+		m_script_id = g_timeout_add(event->delay, script_cb, NULL);
+	}
+
+	return TRUE;
+}
+
+void mock_set_channel(const gchar *channel)
+{
+	if(channel_select(channel))
+		notify();
+}
+
+void mock_set_mute(gboolean mute)
+{
+	if(m_current == NULL)
+		return;
+	m_mute_writes++;
+	channel_set_mute(m_current, mute);
+}
+
+void mock_set_state(int volume, gboolean mute)
+{
+	if(m_current == NULL)
+		return;
+	m_state_writes++;
+	if(mute)
+		channel_set_mute(m_current, TRUE);
+	if(!mute || m_current->has_mute)
+		channel_set_volume(m_current, volume);
+	if(!mute)
+		channel_set_mute(m_current, FALSE);
+}
+
+void mock_set_volume(int volume)
+{
+	if(m_current == NULL)
+		return;
+	m_volume_writes++;
+	channel_set_volume(m_current, volume);
+}
+
+void mock_print_diagnostics()
+{
+	fprintf(stderr, "Mock writes: %u volume, %u mute, %u both\n",
+	        m_volume_writes, m_mute_writes, m_state_writes);
+	fprintf(stderr, "Mock events: %u fired, %u reported\n", m_events_fired,
+	        m_callbacks);
+	if(m_current) {
+		fprintf(stderr, "Mock channel %s: %.2f dB (%.2f to %.2f)%s\n",
+		        m_current->name, m_current->dB, m_current->min_dB,
+		        m_current->max_dB, m_current->mute ? ", muted" : "");
+	}
+}
@@ -0,0 +1,44 @@
+//##############################################################################
+// volumeicon
+//
+// mock_backend.h - implements a volume control abstraction on top of mixers
+//                  that only exist in memory
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+#ifndef __MOCK_BACKEND_H__
+#define __MOCK_BACKEND_H__
+
+gboolean mock_setup(const gchar *card, const gchar *channel,
+                    void (*volume_changed)(int, gboolean));
+
+void mock_set_channel(const gchar *channel);
+void mock_set_volume(int volume);
+void mock_set_mute(gboolean mute);
+void mock_set_state(int volume, gboolean mute);
+
+int mock_get_volume();
+gboolean mock_get_mute();
+const gchar *mock_get_channel();
+const GList *mock_get_channel_names();
+const gchar *mock_get_device();
+const GList *mock_get_device_names();
+void mock_print_diagnostics();
+
+#endif
@@ -22,271 +22,494 @@
 //##############################################################################
 
 #include OSS_HEADER
-#include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <glib.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stropts.h>
+#include <unistd.h>
 
 #include "oss_backend.h"
 
+//##############################################################################
+// Definitions
+//##############################################################################
+// Shortest and longest interval in milliseconds between two checks of the
+// mixer's modify counter. The interval doubles while nothing changes.
+#define POLL_MIN_INTERVAL 16
+#define POLL_MAX_INTERVAL 500
+
+//##############################################################################
+// Type definitions
+//##############################################################################
+// A volume slider of the mixer together with the mute control of its group
+typedef struct {
+	oss_mixext slider;
+	gboolean has_mute;
+	oss_mixext mute;
+} OssControl;
+
 //##############################################################################
 // Static variables
 //##############################################################################
 static char *m_channel = NULL;
+static char *m_device = NULL;
 static GList *m_channel_names = NULL;
+static GList *m_device_names = NULL;
 static int m_actual_maxvalue = 0;
 static int m_mixer_fd = -1;
-static oss_mixext m_ext;
+static int m_mixer_dev = 0;
+static int m_nrext = 0;
+static GHashTable *m_controls = NULL; // slider name -> OssControl
+static OssControl *m_control = NULL;
+static void (*m_volume_changed)(int, gboolean) = NULL;
+static int m_modify_counter = -1;
+static int m_volume = 0;
+static gboolean m_mute = FALSE;
+static guint m_poll_id = 0;
+static guint m_poll_interval = POLL_MIN_INTERVAL;
 
 //##############################################################################
 // Static functions
 //##############################################################################
-static int get_raw_value()
+// Reads the controls of the mixer once, so that getting and setting doesn't
+// have to search through them.
+static void controls_load()
 {
-	assert(m_mixer_fd != -1);
+	m_control = NULL;
+	g_list_free(m_channel_names);
+	m_channel_names = NULL;
+	if(m_controls)
+		g_hash_table_destroy(m_controls);
+	m_controls = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+
+	// Without the number of controls read until there are no more
+	m_nrext = m_mixer_dev;
+	if(ioctl(m_mixer_fd, SNDCTL_MIX_NREXT, &m_nrext) == -1)
+		m_nrext = -1;
+
+	// Mute controls are matched up with the sliders of their group
+	GHashTable *mutes =
+	    g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	GList *controls = NULL;
+	oss_mixext ext;
+	ext.dev = m_mixer_dev;
+	for(ext.ctrl = 0; m_nrext < 0 || ext.ctrl < m_nrext; ext.ctrl++) {
+		if(ioctl(m_mixer_fd, SNDCTL_MIX_EXTINFO, &ext) == -1)
+			break;
+		if(ext.type == MIXT_MUTE &&
+		   !g_hash_table_contains(mutes, GINT_TO_POINTER(ext.parent))) {
+			oss_mixext *mute = g_new(oss_mixext, 1);
+			*mute = ext;
+			g_hash_table_insert(mutes, GINT_TO_POINTER(ext.parent), mute);
+		}
+		else if(ext.type == MIXT_STEREOSLIDER16 ||
+		        ext.type == MIXT_MONOSLIDER16 ||
+		        ext.type == MIXT_STEREOSLIDER || ext.type == MIXT_MONOSLIDER) {
+			if(g_hash_table_contains(m_controls, ext.extname))
+				continue;
+			OssControl *control = g_new0(OssControl, 1);
+			control->slider = ext;
+			g_hash_table_insert(m_controls, control->slider.extname, control);
+			controls = g_list_prepend(controls, control);
+			m_channel_names = g_list_prepend(
+			    m_channel_names, (gpointer)control->slider.extname);
+		}
+	}
+	m_channel_names = g_list_reverse(m_channel_names);
+
+	GList *iter;
+	for(iter = controls; iter != NULL; iter = g_list_next(iter)) {
+		OssControl *control = (OssControl *)iter->data;
+		oss_mixext *mute = g_hash_table_lookup(
+		    mutes, GINT_TO_POINTER(control->slider.parent));
+		if(mute) {
+			control->has_mute = TRUE;
+			control->mute = *mute;
+		}
+	}
+	g_list_free(controls);
+	g_hash_table_destroy(mutes);
+
+	if(m_channel)
+		m_control = g_hash_table_lookup(m_controls, m_channel);
+	if(m_control)
+		m_actual_maxvalue = m_control->slider.maxvalue;
+}
+
+// The values of 16 bit controls are two 16-bit values, with the left
+// channel of a stereo control in the lower 16 bits. Those of 8 bit controls
+// are two 8-bit values.
+typedef struct {
+	int16_t upper;
+	int16_t lower;
+} OssLongValue;
 
+typedef struct {
+	int8_t upper;
+	int8_t lower;
+} OssShortValue;
+
+static gboolean control_read(const oss_mixext *ext, int *value)
+{
 	oss_mixer_value vr;
-	vr.dev = m_ext.dev;
-	vr.ctrl = m_ext.ctrl;
-	vr.timestamp = m_ext.timestamp;
-
-	int result = ioctl(m_mixer_fd, SNDCTL_MIX_READ, &vr);
-	if(result == -1)
-		return 0;
-
-	/*
-	If the control's type is MIXT_STEREOSLIDER16 or MIXT_MONOSLIDER16, we
-	map the value read from the ioctl to a 32-bit field comprised of two
-	16-bit values, with the left channel of a stereo control using the lower
-	16 bits.
-	Likewise, if the control's type has 8-bit precision, we map the values
-	to a 16-bit field.
-	*/
-	struct {
-		int16_t upper;
-		int16_t lower;
-	} * long_value;
-	struct {
-		int8_t upper;
-		int8_t lower;
-	} * short_value;
-	switch(m_ext.type) {
+	vr.dev = ext->dev;
+	vr.ctrl = ext->ctrl;
+	vr.timestamp = ext->timestamp;
+	if(ioctl(m_mixer_fd, SNDCTL_MIX_READ, &vr) == -1)
+		return FALSE;
+	*value = vr.value;
+	return TRUE;
+}
+
+static gboolean control_write(const oss_mixext *ext, int value)
+{
+	oss_mixer_value vr;
+	vr.dev = ext->dev;
+	vr.ctrl = ext->ctrl;
+	vr.timestamp = ext->timestamp;
+	vr.value = value;
+	return ioctl(m_mixer_fd, SNDCTL_MIX_WRITE, &vr) != -1;
+}
+
+// Controls of an old layout carry an old timestamp, using them fails with
+// EIDRM. The table is then rebuilt, TRUE if the current channel is still
+// there to try again on.
+static gboolean controls_stale()
+{
+	if(errno != EIDRM)
+		return FALSE;
+	controls_load();
+	return m_control != NULL;
+}
+
+static gboolean slider_read(int *raw)
+{
+	int value;
+	if(!control_read(&m_control->slider, &value) &&
+	   (!controls_stale() || !control_read(&m_control->slider, &value)))
+		return FALSE;
+
+	switch(m_control->slider.type) {
 	case(MIXT_STEREOSLIDER16):
 	case(MIXT_MONOSLIDER16):
-		long_value = (void *)&vr.value;
-		return long_value->lower;
+		*raw = ((OssLongValue *)&value)->lower;
+		return TRUE;
+	case(MIXT_STEREOSLIDER):
+	case(MIXT_MONOSLIDER):
+		*raw = ((OssShortValue *)&value)->lower;
+		return TRUE;
+	}
+	return FALSE;
+}
 
+static gboolean slider_write(int raw)
+{
+	int value = 0;
+	switch(m_control->slider.type) {
+	case(MIXT_STEREOSLIDER16):
+		((OssLongValue *)&value)->upper = raw;
+		((OssLongValue *)&value)->lower = raw;
+		break;
 	case(MIXT_STEREOSLIDER):
+		((OssShortValue *)&value)->upper = raw;
+		((OssShortValue *)&value)->lower = raw;
+		break;
+	case(MIXT_MONOSLIDER16):
 	case(MIXT_MONOSLIDER):
-		short_value = (void *)&vr.value;
-		return short_value->lower;
+		value = raw;
+		break;
+	default:
+		return FALSE;
 	}
+	return control_write(&m_control->slider, value) ||
+	       (controls_stale() && control_write(&m_control->slider, value));
+}
 
-	return 0;
+static gboolean mute_read(gboolean *mute)
+{
+	int value;
+	if(!control_read(&m_control->mute, &value) &&
+	   (!controls_stale() || !m_control->has_mute ||
+	    !control_read(&m_control->mute, &value)))
+		return FALSE;
+	*mute = value ? TRUE : FALSE;
+	return TRUE;
 }
 
-//##############################################################################
-// Exported functions
-//##############################################################################
-const gchar *oss_get_channel() { return m_channel; }
+static gboolean mute_write(gboolean mute)
+{
+	return control_write(&m_control->mute, mute ? 1 : 0) ||
+	       (controls_stale() && m_control->has_mute &&
+	        control_write(&m_control->mute, mute ? 1 : 0));
+}
 
-const GList *oss_get_channel_names() { return m_channel_names; }
+static int volume_from_raw(int raw)
+{
+	return m_actual_maxvalue > 0 ? 100 * raw / m_actual_maxvalue : 0;
+}
 
-int oss_get_volume()
+// Reads the volume and mute of the current channel
+static void state_read()
 {
-	assert(m_mixer_fd != -1);
-	if(m_actual_maxvalue == 0)
-		return 0;
-	return 100 * get_raw_value() / m_actual_maxvalue;
+	int raw;
+	m_volume = m_control && slider_read(&raw) ? volume_from_raw(raw) : 0;
+	if(m_control == NULL || !m_control->has_mute || !mute_read(&m_mute))
+		m_mute = FALSE;
 }
 
-gboolean oss_get_mute()
+// The modify counter of a mixer goes up whenever one of its controls
+// changes, reading it is a lot cheaper than reading the controls.
+static int get_modify_counter()
 {
-	assert(m_mixer_fd != -1);
-
-	gboolean mute = FALSE;
-
-	// Save current control;
-	int parent = m_ext.parent;
-	int control = m_ext.ctrl;
-
-	// Check for mute in this group
-	m_ext.ctrl = 0;
-	while(ioctl(m_mixer_fd, SNDCTL_MIX_EXTINFO, &m_ext) >= 0) {
-		if(m_ext.parent == parent && m_ext.type == MIXT_MUTE) {
-			oss_mixer_value vr;
-			vr.dev = m_ext.dev;
-			vr.ctrl = m_ext.ctrl;
-			vr.timestamp = m_ext.timestamp;
-			if(ioctl(m_mixer_fd, SNDCTL_MIX_READ, &vr) != -1)
-				mute = vr.value ? TRUE : FALSE;
-			break;
+	oss_mixerinfo mi;
+	mi.dev = m_mixer_dev;
+	if(ioctl(m_mixer_fd, SNDCTL_MIXERINFO, &mi) == -1)
+		return -1;
+	return mi.modify_counter;
+}
+
+// Remembers the state we know about, so only changes made by others get
+// reported.
+static void state_refresh()
+{
+	m_modify_counter = get_modify_counter();
+	state_read();
+}
+
+static const char *mixer_device_path()
+{
+	const char *devmixer = getenv("OSS_MIXERDEV");
+	return devmixer ? devmixer : "/dev/mixer";
+}
+
+// Lists the mixers as devices and picks the one setup was asked for. Mixers
+// are known by their names, "default" is the first one.
+static void devices_load(int nmix)
+{
+	g_list_free_full(m_device_names, g_free);
+	m_device_names = NULL;
+	m_device_names =
+	    g_list_prepend(m_device_names, (gpointer)g_strdup("default"));
+	gboolean encountered_provided_device = g_strcmp0("default", m_device) == 0;
+	m_mixer_dev = 0;
+
+	int dev;
+	for(dev = 0; dev < nmix; dev++) {
+		oss_mixerinfo mi;
+		mi.dev = dev;
+		if(ioctl(m_mixer_fd, SNDCTL_MIXERINFO, &mi) == -1 || !mi.enabled)
+			continue;
+		m_device_names =
+		    g_list_prepend(m_device_names, (gpointer)g_strdup(mi.name));
+		if(!encountered_provided_device && g_strcmp0(mi.name, m_device) == 0) {
+			encountered_provided_device = TRUE;
+			m_mixer_dev = dev;
 		}
-		m_ext.ctrl++;
 	}
 
-	// Restore to previous control
-	m_ext.ctrl = control;
-	ioctl(m_mixer_fd, SNDCTL_MIX_EXTINFO, &m_ext);
+	if(!encountered_provided_device && m_device != NULL) {
+		m_device_names =
+		    g_list_prepend(m_device_names, (gpointer)g_strdup(m_device));
+	}
+	m_device_names = g_list_reverse(m_device_names);
+}
+
+static void mixer_close()
+{
+	if(m_poll_id != 0) {
+		g_source_remove(m_poll_id);
+		m_poll_id = 0;
+	}
+	m_poll_interval = POLL_MIN_INTERVAL;
+	m_control = NULL;
+	m_actual_maxvalue = 0;
+	g_list_free(m_channel_names);
+	m_channel_names = NULL;
+	if(m_controls) {
+		g_hash_table_destroy(m_controls);
+		m_controls = NULL;
+	}
+	if(m_mixer_fd != -1) {
+		close(m_mixer_fd);
+		m_mixer_fd = -1;
+	}
+	m_volume = 0;
+	m_mute = FALSE;
+}
+
+static gboolean poll_cb(gpointer data)
+{
+	int volume = m_volume;
+	gboolean mute = m_mute;
+	if(get_modify_counter() != m_modify_counter) {
+		// Controls can come and go, like with a jack being plugged in. A
+		// layout with as many controls as before is caught by the stale
+		// timestamps when reading the state.
+		int nrext = m_mixer_dev;
+		if(ioctl(m_mixer_fd, SNDCTL_MIX_NREXT, &nrext) != -1 &&
+		   nrext != m_nrext)
+			controls_load();
+		state_refresh();
+		m_poll_interval = POLL_MIN_INTERVAL;
+	}
+	else {
+		m_poll_interval = MIN(m_poll_interval * 2, POLL_MAX_INTERVAL);
+	}
+
+	m_poll_id = g_timeout_add(m_poll_interval, poll_cb, NULL);
+	if(m_volume_changed && (volume != m_volume || mute != m_mute))
+		m_volume_changed(m_volume, m_mute);
+	return FALSE;
+}
+
+// Returns FALSE if the channel is already selected
+static gboolean channel_select(const gchar *channel)
+{
+	if(g_strcmp0(channel, m_channel) == 0)
+		return FALSE;
+
+	// Clean up any previously set channels
+	g_free(m_channel);
+	m_channel = g_strdup(channel);
 
-	return mute;
+	m_control = g_hash_table_lookup(m_controls, channel);
+	if(m_control)
+		m_actual_maxvalue = m_control->slider.maxvalue;
+	state_read();
+	return TRUE;
+}
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+const gchar *oss_get_channel() { return m_channel; }
+
+const gchar *oss_get_device() { return m_device; }
+
+const GList *oss_get_channel_names() { return m_channel_names; }
+
+const GList *oss_get_device_names() { return m_device_names; }
+
+// The state is read on setup and channel switches and kept up to date by
+// poll_cb, so getting it takes no ioctl
+int oss_get_volume() { return m_volume; }
+
+gboolean oss_get_mute() { return m_mute; }
+
+gboolean oss_probe()
+{
+	int fd = open(mixer_device_path(), O_RDWR, 0);
+	if(fd == -1)
+		return FALSE;
+	close(fd);
+	return TRUE;
 }
 
 gboolean oss_setup(const gchar *card, const gchar *channel,
                    void (*volume_changed)(int, gboolean))
 {
-	// Make sure (for now) that the setup function only gets called once
-	static int oss_setup_called = 0;
-	assert(oss_setup_called == 0);
-	oss_setup_called++;
+	// Clean up resources from previous calls to setup
+	g_free(m_channel);
+	m_channel = NULL;
+	mixer_close();
+
+	// Save card, volume_changed
+	g_free(m_device);
+	m_device = g_strdup(card);
+	m_volume_changed = volume_changed;
 
 	// Get ahold of the mixer device
-	char *devmixer;
-	if((devmixer = getenv("OSS_MIXERDEV")) == NULL)
-		devmixer = "/dev/mixer";
+	const char *devmixer = mixer_device_path();
 	if((m_mixer_fd = open(devmixer, O_RDWR, 0)) == -1) {
 		perror(devmixer);
-		exit(1);
+		devices_load(0);
+		return FALSE;
 	}
 
 	// Check that there is at least one mixer
-	int nmix;
-	ioctl(m_mixer_fd, SNDCTL_MIX_NRMIX, &nmix);
-	if(nmix <= 0) {
-		perror(devmixer);
-		exit(EXIT_FAILURE);
-	}
-
-	m_ext.dev = 0;
-	m_ext.ctrl = 0;
-	while(ioctl(m_mixer_fd, SNDCTL_MIX_EXTINFO, &m_ext) >= 0) {
-		if(m_ext.type == MIXT_STEREOSLIDER16 ||
-		   m_ext.type == MIXT_MONOSLIDER16 ||
-		   m_ext.type == MIXT_STEREOSLIDER || m_ext.type == MIXT_MONOSLIDER) {
-			m_channel_names = g_list_append(m_channel_names,
-			                                (gpointer)g_strdup(m_ext.extname));
-		}
-		m_ext.ctrl++;
+	int nmix = 0;
+	if(ioctl(m_mixer_fd, SNDCTL_MIX_NRMIX, &nmix) == -1 || nmix <= 0) {
+		fprintf(stderr, "No mixers found on %s\n", devmixer);
+		devices_load(0);
+		mixer_close();
+		return FALSE;
 	}
+	devices_load(nmix);
+	controls_load();
 
 	// Setup channel using the provided channelname
-	if(channel != NULL)
-		oss_set_channel(channel);
-	else if(channel == NULL && m_channel_names != NULL)
-		oss_set_channel((const gchar *)m_channel_names->data);
+	if(channel != NULL && g_hash_table_contains(m_controls, channel))
+		channel_select(channel);
+	else if(m_channel_names != NULL)
+		channel_select((const gchar *)m_channel_names->data);
+
+	// OSS doesn't tell us about changes, so watch the modify counter
+	state_refresh();
+	m_poll_id = g_timeout_add(m_poll_interval, poll_cb, NULL);
 
 	return TRUE;
 }
 
 void oss_set_channel(const gchar *channel)
 {
-	assert(channel != NULL);
-	assert(m_mixer_fd != -1);
-
-	if(g_strcmp0(channel, m_channel) == 0)
+	if(m_mixer_fd == -1 || channel == NULL)
 		return;
-
-	// Clean up any previously set channels
-	g_free(m_channel);
-	m_channel = g_strdup(channel);
-
-	// Find channel and then return
-	m_ext.dev = 0;
-	m_ext.ctrl = 0;
-	while(ioctl(m_mixer_fd, SNDCTL_MIX_EXTINFO, &m_ext) >= 0) {
-		if(g_strcmp0(channel, m_ext.extname) == 0) {
-			m_actual_maxvalue = m_ext.maxvalue;
-			return;
-		}
-		m_ext.ctrl++;
-	}
+	if(channel_select(channel) && m_volume_changed)
+		m_volume_changed(m_volume, m_mute);
 }
 
 void oss_set_mute(gboolean mute)
 {
-	assert(m_mixer_fd != -1);
-
-	gboolean mute_found = FALSE;
-	int parent = m_ext.parent;
-	int control = m_ext.ctrl;
-
-	// Check for mute in this group
-	m_ext.ctrl = 0;
-	while(ioctl(m_mixer_fd, SNDCTL_MIX_EXTINFO, &m_ext) >= 0) {
-		if(m_ext.parent == parent && m_ext.type == MIXT_MUTE) {
-			oss_mixer_value vr;
-			vr.dev = m_ext.dev;
-			vr.ctrl = m_ext.ctrl;
-			vr.timestamp = m_ext.timestamp;
-			vr.value = mute ? 1 : 0;
-			ioctl(m_mixer_fd, SNDCTL_MIX_WRITE, &vr);
-			mute_found = TRUE;
-			break;
-		}
-		m_ext.ctrl++;
-	}
-
-	// Restore to previous control
-	m_ext.ctrl = control;
-	ioctl(m_mixer_fd, SNDCTL_MIX_EXTINFO, &m_ext);
+	if(m_mixer_fd == -1 || m_control == NULL)
+		return;
 
+	// Our own writes move the modify counter too, poll_cb finds nothing
+	// changed when it reads the state
+	if(m_control->has_mute) {
+		if(mute_write(mute))
+			m_mute = mute;
+	}
 	// If no mute control was found, revert to setting the volume to zero
-	if(!mute_found && mute) {
+	else if(mute) {
 		oss_set_volume(0);
 	}
 }
 
-void oss_set_volume(int volume)
+// Only the controls which change are written. Muting happens before and
+// unmuting after the volume change, so the step in between isn't heard.
+void oss_set_state(int volume, gboolean mute)
 {
-	assert(m_mixer_fd != -1);
+	if(m_mixer_fd == -1 || m_control == NULL)
+		return;
 	volume = (volume < 0 ? 0 : (volume > 100 ? 100 : volume));
-
-	oss_mixer_value vr;
-	vr.dev = m_ext.dev;
-	vr.ctrl = m_ext.ctrl;
-	vr.timestamp = m_ext.timestamp;
-
-	struct {
-		int16_t upper;
-		int16_t lower;
-	} * long_value;
-	struct {
-		int8_t upper;
-		int8_t lower;
-	} * short_value;
-	switch(m_ext.type) {
-	case(MIXT_STEREOSLIDER16):
-	case(MIXT_MONOSLIDER16):
-		long_value = (void *)&vr.value;
-		;
-	case(MIXT_STEREOSLIDER):
-	case(MIXT_MONOSLIDER):
-		short_value = (void *)&vr.value;
-		;
+	if(!m_control->has_mute) {
+		oss_set_volume(mute ? 0 : volume);
+		return;
 	}
 
-	switch(m_ext.type) {
-	case(MIXT_STEREOSLIDER16):
-		long_value->upper = m_actual_maxvalue * volume / 100;
-		long_value->lower = m_actual_maxvalue * volume / 100;
-		break;
-	case(MIXT_MONOSLIDER16):
-		vr.value = m_actual_maxvalue * volume / 100;
-		break;
-	case(MIXT_STEREOSLIDER):
-		short_value->upper = m_actual_maxvalue * volume / 100;
-		short_value->lower = m_actual_maxvalue * volume / 100;
-		break;
-	case(MIXT_MONOSLIDER):
-		vr.value = m_actual_maxvalue * volume / 100;
-		break;
-	default:
+	if(mute && !m_mute)
+		oss_set_mute(TRUE);
+	if(volume != m_volume)
+		oss_set_volume(volume);
+	if(!mute && m_mute)
+		oss_set_mute(FALSE);
+}
+
+void oss_set_volume(int volume)
+{
+	if(m_mixer_fd == -1 || m_control == NULL)
 		return;
-	}
+	volume = (volume < 0 ? 0 : (volume > 100 ? 100 : volume));
 
-	ioctl(m_mixer_fd, SNDCTL_MIX_WRITE, &vr);
+	int raw = m_actual_maxvalue * volume / 100;
+	if(!slider_write(raw))
+		return;
 
-	if(volume == 100)
-		m_actual_maxvalue = get_raw_value();
+	// Some drivers stop short of the maximum they report, the value they
+	// took is read back to scale with from then on
+	if(volume == 100 && slider_read(&raw))
+		m_actual_maxvalue = raw;
+	m_volume = volume_from_raw(raw);
 }
@@ -0,0 +1,452 @@
+//##############################################################################
+// volumeicon
+//
+// pulse_backend.c - implements a volume control abstraction using the
+//                   PulseAudio asynchronous API
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+#include <glib.h>
+#include <pulse/glib-mainloop.h>
+#include <pulse/pulseaudio.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "backend.h"
+#include "pulse_backend.h"
+
+//##############################################################################
+// Definitions
+//##############################################################################
+// Delay in milliseconds before connecting again after losing the server
+#define RECONNECT_DELAY 500
+
+// How long close waits in milliseconds for our writes to be answered
+#define CLOSE_TIMEOUT 500
+
+// Sinks only have one volume, which is shown as this channel
+#define PULSE_CHANNEL "Master"
+#define PULSE_DEFAULT_DEVICE "default"
+
+//##############################################################################
+// Static variables
+//##############################################################################
+static pa_glib_mainloop *m_mainloop = NULL;
+static pa_context *m_context = NULL;
+static gboolean m_ready = FALSE;
+static gboolean m_announce = FALSE; // report the sink even if unchanged
+static int m_writes = 0;            // writes waiting for their answer
+static guint m_reconnect_id = 0;
+
+static gchar *m_device = NULL;
+static gchar *m_channel = NULL;
+static GList *m_channel_names = NULL;
+static GList *m_device_names = NULL;
+static GList *m_loading_device_names = NULL;
+static gchar *m_default_sink = NULL;
+static void (*m_volume_changed)(int, gboolean) = NULL;
+static void (*m_devices_changed)(void) = NULL;
+
+// The sink we control
+static gchar *m_sink = NULL;
+static uint32_t m_sink_index = PA_INVALID_INDEX;
+static pa_cvolume m_cvolume;
+static int m_volume = 0;
+static gboolean m_mute = FALSE;
+
+//##############################################################################
+// Function prototypes
+//##############################################################################
+static void context_connect();
+
+//##############################################################################
+// Static functions
+//##############################################################################
+// The answers come in through the callbacks, nothing waits for them
+static void query_send(pa_operation *operation)
+{
+	if(operation)
+		pa_operation_unref(operation);
+}
+
+static const gchar *sink_wanted()
+{
+	if(g_strcmp0(m_device, PULSE_DEFAULT_DEVICE) == 0)
+		return m_default_sink;
+	return m_device;
+}
+
+// Volumes above PA_VOLUME_NORM are a software boost and come out above 100
+static int volume_from_pa(const pa_cvolume *cvolume)
+{
+	guint64 volume = pa_cvolume_max(cvolume);
+	volume = (volume * 100 + PA_VOLUME_NORM / 2) / PA_VOLUME_NORM;
+	return (int)MIN(volume, BACKEND_VOLUME_BOOST_MAX);
+}
+
+static void sink_info_cb(pa_context *c, const pa_sink_info *i, int eol,
+                         void *userdata)
+{
+	if(eol < 0 && pa_context_errno(c) == PA_ERR_NOENTITY) {
+		fprintf(stderr, "PulseAudio: sink %s not available\n", sink_wanted());
+		return;
+	}
+	if(eol != 0)
+		return;
+
+	// Answers for a sink we switched away from in the meantime, or from
+	// before our own writes went through
+	if(g_strcmp0(i->name, sink_wanted()) != 0 ||
+	   (m_writes > 0 && i->index == m_sink_index))
+		return;
+
+	int volume = m_volume;
+	gboolean mute = m_mute;
+	if(g_strcmp0(i->name, m_sink) != 0) {
+		g_free(m_sink);
+		m_sink = g_strdup(i->name);
+	}
+	m_sink_index = i->index;
+	m_cvolume = i->volume;
+	m_volume = volume_from_pa(&i->volume);
+	m_mute = i->mute ? TRUE : FALSE;
+
+	// Setup doesn't wait for the sink, so its first answer is always passed on
+	if(m_volume_changed &&
+	   (m_announce || volume != m_volume || mute != m_mute))
+		m_volume_changed(m_volume, m_mute);
+	m_announce = FALSE;
+}
+
+static void sink_select()
+{
+	const gchar *sink = sink_wanted();
+	if(sink == NULL)
+		return;
+	if(g_strcmp0(sink, m_sink) != 0)
+		m_sink_index = PA_INVALID_INDEX;
+	query_send(pa_context_get_sink_info_by_name(m_context, sink,
+	                                            sink_info_cb, NULL));
+}
+
+static void sink_list_cb(pa_context *c, const pa_sink_info *i, int eol,
+                         void *userdata)
+{
+	if(eol == 0) {
+		m_loading_device_names = g_list_prepend(
+		    m_loading_device_names, (gpointer)g_strdup(i->name));
+		return;
+	}
+
+	// Sinks are known by their names, "default" follows the server's choice
+	GList *names = g_list_reverse(m_loading_device_names);
+	m_loading_device_names = NULL;
+	names = g_list_prepend(names, (gpointer)g_strdup(PULSE_DEFAULT_DEVICE));
+	if(m_device != NULL &&
+	   g_list_find_custom(names, m_device, (GCompareFunc)g_strcmp0) == NULL)
+		names = g_list_append(names, (gpointer)g_strdup(m_device));
+
+	g_list_free_full(m_device_names, g_free);
+	m_device_names = names;
+	if(m_devices_changed)
+		m_devices_changed();
+}
+
+static void server_info_cb(pa_context *c, const pa_server_info *i,
+                           void *userdata)
+{
+	if(i == NULL)
+		return;
+	gboolean changed = g_strcmp0(i->default_sink_name, m_default_sink) != 0;
+	g_free(m_default_sink);
+	m_default_sink = g_strdup(i->default_sink_name);
+	if(changed || m_sink_index == PA_INVALID_INDEX)
+		sink_select();
+}
+
+static void subscribe_cb(pa_context *c, pa_subscription_event_type_t t,
+                         uint32_t idx, void *userdata)
+{
+	pa_subscription_event_type_t facility =
+	    t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+	pa_subscription_event_type_t type = t & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+
+	if(facility == PA_SUBSCRIPTION_EVENT_SERVER) {
+		// The default sink might have changed
+		query_send(pa_context_get_server_info(c, server_info_cb, NULL));
+	}
+	else if(facility == PA_SUBSCRIPTION_EVENT_SINK) {
+		if(type != PA_SUBSCRIPTION_EVENT_CHANGE) {
+			query_send(
+			    pa_context_get_sink_info_list(c, sink_list_cb, NULL));
+		}
+		if(type == PA_SUBSCRIPTION_EVENT_REMOVE && idx == m_sink_index)
+			m_sink_index = PA_INVALID_INDEX;
+		else if(type == PA_SUBSCRIPTION_EVENT_NEW &&
+		        m_sink_index == PA_INVALID_INDEX)
+			sink_select();
+		else if(type == PA_SUBSCRIPTION_EVENT_CHANGE && idx == m_sink_index) {
+			query_send(pa_context_get_sink_info_by_index(
+			    c, idx, sink_info_cb, NULL));
+		}
+	}
+}
+
+// Writes aren't waited for. Once the last one is through the sink is read
+// again, in case it ended up somewhere else than we asked for.
+static void write_done_cb(pa_context *c, int success, void *userdata)
+{
+	m_writes--;
+	if(!success) {
+		fprintf(stderr, "PulseAudio: %s\n",
+		        pa_strerror(pa_context_errno(c)));
+	}
+	if(m_writes == 0 && m_sink_index != PA_INVALID_INDEX) {
+		query_send(pa_context_get_sink_info_by_index(c, m_sink_index,
+		                                             sink_info_cb, NULL));
+	}
+}
+
+static gboolean reconnect_cb(gpointer data)
+{
+	m_reconnect_id = 0;
+	context_connect();
+	return FALSE;
+}
+
+static void context_state_cb(pa_context *c, void *userdata)
+{
+	switch(pa_context_get_state(c)) {
+	case PA_CONTEXT_READY:
+		m_ready = TRUE;
+		pa_context_set_subscribe_callback(c, subscribe_cb, NULL);
+		pa_operation_unref(pa_context_subscribe(
+		    c, PA_SUBSCRIPTION_MASK_SINK | PA_SUBSCRIPTION_MASK_SERVER, NULL,
+		    NULL));
+		query_send(pa_context_get_server_info(c, server_info_cb, NULL));
+		query_send(pa_context_get_sink_info_list(c, sink_list_cb, NULL));
+		break;
+	case PA_CONTEXT_FAILED:
+	case PA_CONTEXT_TERMINATED:
+		// Operations of a dead context never get their answer
+		m_ready = FALSE;
+		m_writes = 0;
+		m_sink_index = PA_INVALID_INDEX;
+		g_list_free_full(m_loading_device_names, g_free);
+		m_loading_device_names = NULL;
+		if(m_reconnect_id == 0) {
+			m_reconnect_id =
+			    g_timeout_add(RECONNECT_DELAY, reconnect_cb, NULL);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void context_connect()
+{
+	if(m_context) {
+		pa_context_set_state_callback(m_context, NULL, NULL);
+		pa_context_disconnect(m_context);
+		pa_context_unref(m_context);
+	}
+	if(m_mainloop == NULL)
+		m_mainloop = pa_glib_mainloop_new(NULL);
+
+	m_context =
+	    pa_context_new(pa_glib_mainloop_get_api(m_mainloop), "volumeicon");
+	pa_context_set_state_callback(m_context, context_state_cb, NULL);
+
+	// Wait for the server to show up instead of failing right away, it
+	// might just be restarting
+	if(pa_context_connect(m_context, NULL, PA_CONTEXT_NOFAIL, NULL) < 0) {
+		fprintf(stderr, "PulseAudio: %s\n",
+		        pa_strerror(pa_context_errno(m_context)));
+	}
+}
+
+static gboolean wait_timeout_cb(gpointer data)
+{
+	*(gboolean *)data = TRUE;
+	return FALSE;
+}
+
+// Runs the main loop until the server answered all our writes
+static gboolean wait_for_writes()
+{
+	gboolean timed_out = FALSE;
+	guint timeout_id =
+	    g_timeout_add(CLOSE_TIMEOUT, wait_timeout_cb, &timed_out);
+	while(!timed_out && m_writes > 0 &&
+	      PA_CONTEXT_IS_GOOD(pa_context_get_state(m_context)))
+		g_main_context_iteration(NULL, TRUE);
+	if(!timed_out)
+		g_source_remove(timeout_id);
+	return m_writes == 0;
+}
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+const gchar *pulse_get_channel() { return m_channel; }
+
+const gchar *pulse_get_device() { return m_device; }
+
+const GList *pulse_get_channel_names() { return m_channel_names; }
+
+const GList *pulse_get_device_names() { return m_device_names; }
+
+void pulse_watch_devices(void (*devices_changed)(void))
+{
+	m_devices_changed = devices_changed;
+}
+
+int pulse_get_volume() { return m_volume; }
+
+gboolean pulse_get_mute() { return m_mute; }
+
+// A server is around if it was pointed out to us or its socket is there
+gboolean pulse_probe()
+{
+	if(getenv("PULSE_SERVER") != NULL)
+		return TRUE;
+	gchar *path =
+	    g_build_filename(g_get_user_runtime_dir(), "pulse", "native", NULL);
+	gboolean found = g_file_test(path, G_FILE_TEST_EXISTS);
+	g_free(path);
+	return found;
+}
+
+// Returns right away, the volume of the sink is reported through
+// volume_changed once the server told us about it
+gboolean pulse_setup(const gchar *card, const gchar *channel,
+                     void (*volume_changed)(int, gboolean))
+{
+	// Save card, volume_changed
+	g_free(m_device);
+	m_device = g_strdup(card ? card : PULSE_DEFAULT_DEVICE);
+	m_volume_changed = volume_changed;
+
+	if(m_channel_names == NULL) {
+		m_channel_names =
+		    g_list_append(NULL, (gpointer)g_strdup(PULSE_CHANNEL));
+	}
+	if(m_device_names == NULL) {
+		m_device_names =
+		    g_list_append(NULL, (gpointer)g_strdup(PULSE_DEFAULT_DEVICE));
+	}
+	pulse_set_channel(channel);
+
+	// The connection is kept across setups, only the sink changes
+	m_announce = TRUE;
+	if(m_ready) {
+		sink_select();
+	}
+	else if(m_context == NULL || m_reconnect_id != 0) {
+		if(m_reconnect_id != 0) {
+			g_source_remove(m_reconnect_id);
+			m_reconnect_id = 0;
+		}
+		context_connect();
+	}
+	return m_context != NULL &&
+	       PA_CONTEXT_IS_GOOD(pa_context_get_state(m_context));
+}
+
+// Only called once the main loop is done, so nothing else runs while we wait
+void pulse_close()
+{
+	if(m_context == NULL)
+		return;
+	if(!wait_for_writes())
+		fprintf(stderr, "PulseAudio: timed out writing to sink %s\n", m_sink);
+
+	pa_context_set_state_callback(m_context, NULL, NULL);
+	pa_context_disconnect(m_context);
+	pa_context_unref(m_context);
+	m_context = NULL;
+	m_ready = FALSE;
+	m_writes = 0;
+	m_sink_index = PA_INVALID_INDEX;
+	if(m_reconnect_id != 0) {
+		g_source_remove(m_reconnect_id);
+		m_reconnect_id = 0;
+	}
+}
+
+void pulse_set_channel(const gchar *channel)
+{
+	if(g_strcmp0(channel, PULSE_CHANNEL) != 0)
+		channel = PULSE_CHANNEL;
+	g_free(m_channel);
+	m_channel = g_strdup(channel);
+}
+
+void pulse_set_mute(gboolean mute)
+{
+	if(!m_ready || m_sink_index == PA_INVALID_INDEX)
+		return;
+	m_mute = mute;
+	pa_operation *operation = pa_context_set_sink_mute_by_index(
+	    m_context, m_sink_index, mute, write_done_cb, NULL);
+	if(operation) {
+		m_writes++;
+		pa_operation_unref(operation);
+	}
+}
+
+// The server runs the writes in order. Muting goes before and unmuting after
+// the volume change, so the step in between isn't heard.
+void pulse_set_state(int volume, gboolean mute)
+{
+	if(!m_ready || m_sink_index == PA_INVALID_INDEX)
+		return;
+	volume = CLAMP(volume, 0, BACKEND_VOLUME_BOOST_MAX);
+
+	if(mute && !m_mute)
+		pulse_set_mute(TRUE);
+	if(volume != m_volume)
+		pulse_set_volume(volume);
+	if(!mute && m_mute)
+		pulse_set_mute(FALSE);
+}
+
+void pulse_set_volume(int volume)
+{
+	if(!m_ready || m_sink_index == PA_INVALID_INDEX)
+		return;
+	volume = CLAMP(volume, 0, BACKEND_VOLUME_BOOST_MAX);
+
+	// Scale all channels alike so the balance stays the same
+	pa_volume_t pa_volume =
+	    (pa_volume_t)((guint64)PA_VOLUME_NORM * volume / 100);
+	if(pa_cvolume_max(&m_cvolume) == PA_VOLUME_MUTED)
+		pa_cvolume_set(&m_cvolume, m_cvolume.channels, pa_volume);
+	else
+		pa_cvolume_scale(&m_cvolume, pa_volume);
+	m_volume = volume;
+
+	pa_operation *operation = pa_context_set_sink_volume_by_index(
+	    m_context, m_sink_index, &m_cvolume, write_done_cb, NULL);
+	if(operation) {
+		m_writes++;
+		pa_operation_unref(operation);
+	}
+}
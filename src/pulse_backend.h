@@ -0,0 +1,46 @@
+//##############################################################################
+// volumeicon
+//
+// pulse_backend.h - implements a volume control abstraction using the
+//                   PulseAudio asynchronous API
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+#ifndef __PULSE_BACKEND_H__
+#define __PULSE_BACKEND_H__
+
+gboolean pulse_probe();
+gboolean pulse_setup(const gchar *card, const gchar *channel,
+                     void (*volume_changed)(int, gboolean));
+
+void pulse_set_channel(const gchar *channel);
+void pulse_set_volume(int volume);
+void pulse_set_mute(gboolean mute);
+void pulse_set_state(int volume, gboolean mute);
+
+int pulse_get_volume();
+gboolean pulse_get_mute();
+const gchar *pulse_get_channel();
+const GList *pulse_get_channel_names();
+const gchar *pulse_get_device();
+const GList *pulse_get_device_names();
+void pulse_watch_devices(void (*devices_changed)(void));
+void pulse_close();
+
+#endif
@@ -0,0 +1,303 @@
+//##############################################################################
+// volumeicon
+//
+// bench_alsa_backends.c - compares setup of the alsa and alsa-ctl backends
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+// Usage: bench_alsa_backends [DEVICE [CHANNEL [RUNS]]]
+//
+// Sets the backends up on the device RUNS times and prints the median time
+// until the channels are known, along with how many there are and the
+// resident memory afterwards. The alsa backend is run twice, loading all
+// channels like with the preferences open and loading only CHANNEL like at
+// startup. Cards with many controls, like HDA codecs with lots of pins,
+// show the difference best. Each backend runs in a process of its own so
+// their memory use can be compared.
+//
+// Then the volume is set and read back in a loop, and changed from a mixer
+// of our own until the backend reports it, to time the calls the icon makes
+// and the handling of the events it gets.
+
+#include <alsa/asoundlib.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "alsa_backend.h"
+#include "alsa_ctl_backend.h"
+
+//##############################################################################
+// Definitions
+//##############################################################################
+#define DEFAULT_RUNS 20
+#define DEFAULT_CHANNEL "Master"
+#define SETUP_WAIT 5000
+#define EVENT_WAIT 1000
+#define CALL_RUNS 1000
+#define EVENT_RUNS 200
+
+//##############################################################################
+// Type definitions
+//##############################################################################
+typedef struct {
+	const gchar *name;
+	void (*prepare)(void); // NULL if nothing is needed before setup
+	gboolean (*setup)(const gchar *, const gchar *, void (*)(int, gboolean));
+	const GList *(*get_channel_names)(void);
+	const gchar *(*get_channel)(void);
+	int (*get_volume)(void);
+	void (*set_volume)(int);
+} Bench;
+
+//##############################################################################
+// Static variables
+//##############################################################################
+static guint m_reports = 0;
+
+// Our own mixer, changing the volume behind the backend's back
+static snd_mixer_t *m_writer = NULL;
+static snd_mixer_elem_t *m_writer_elem = NULL;
+
+//##############################################################################
+// Static functions
+//##############################################################################
+static void on_volume_changed(int volume, gboolean mute) { m_reports++; }
+
+static gboolean on_timeout(gpointer user_data)
+{
+	*(gboolean *)user_data = TRUE;
+	return FALSE;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+	gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Resident memory of the process in kB, -1 if it can't be read
+static long rss_kb()
+{
+	gchar *status = NULL;
+	long rss = -1;
+	if(g_file_get_contents("/proc/self/status", &status, NULL, NULL)) {
+		const gchar *line = strstr(status, "VmRSS:");
+		if(line)
+			rss = atol(line + strlen("VmRSS:"));
+		g_free(status);
+	}
+	return rss;
+}
+
+// The alsa backend sets up in the background, so the time until the channels
+// are known is what counts.
+static const GList *wait_for_channels(const GList *(*get_channel_names)(void))
+{
+	gboolean timed_out = FALSE;
+	guint timeout_id = g_timeout_add(SETUP_WAIT, on_timeout, &timed_out);
+	const GList *names;
+	while((names = get_channel_names()) == NULL && !timed_out)
+		g_main_context_iteration(NULL, TRUE);
+	if(!timed_out)
+		g_source_remove(timeout_id);
+	return names;
+}
+
+// Runs the main loop until the backend reports a change, FALSE on timeout
+static gboolean wait_for_report(guint reports)
+{
+	gboolean timed_out = FALSE;
+	guint timeout_id = g_timeout_add(EVENT_WAIT, on_timeout, &timed_out);
+	while(m_reports == reports && !timed_out)
+		g_main_context_iteration(NULL, TRUE);
+	if(!timed_out)
+		g_source_remove(timeout_id);
+	return !timed_out;
+}
+
+static gboolean writer_open(const gchar *device, const gchar *channel)
+{
+	if(snd_mixer_open(&m_writer, 0) < 0)
+		return FALSE;
+	if(snd_mixer_attach(m_writer, device) < 0 ||
+	   snd_mixer_selem_register(m_writer, NULL, NULL) < 0 ||
+	   snd_mixer_load(m_writer) < 0) {
+		snd_mixer_close(m_writer);
+		m_writer = NULL;
+		return FALSE;
+	}
+	snd_mixer_selem_id_t *sid = NULL;
+	snd_mixer_selem_id_alloca(&sid);
+	snd_mixer_selem_id_set_name(sid, channel);
+	m_writer_elem = snd_mixer_find_selem(m_writer, sid);
+	return m_writer_elem != NULL &&
+	       snd_mixer_selem_has_playback_volume(m_writer_elem);
+}
+
+static void writer_close()
+{
+	if(m_writer)
+		snd_mixer_close(m_writer);
+	m_writer = NULL;
+	m_writer_elem = NULL;
+}
+
+// Sets and reads back the volume like scrolling on the icon does. The alsa
+// backend applies the writes on its own thread, so only what the caller
+// waits for is timed.
+static void bench_calls(const Bench *bench)
+{
+	gint64 start = g_get_monotonic_time();
+	int i;
+	for(i = 0; i < CALL_RUNS; i++) {
+		bench->set_volume(i % 101);
+		bench->get_volume();
+	}
+	gint64 elapsed = g_get_monotonic_time() - start;
+
+	// Hand the reports of our own writes out before the events are timed
+	while(g_main_context_iteration(NULL, FALSE))
+		;
+	printf("%-9s set and get %7.2f us per call (%d calls)\n", "",
+	       elapsed / 1000.0 / CALL_RUNS, CALL_RUNS);
+}
+
+// Changes the volume from our own mixer and waits for the backend to report
+// it, like when another mixer application is used
+static void bench_events(const Bench *bench, const gchar *device)
+{
+	const gchar *channel = bench->get_channel();
+	if(channel == NULL || !writer_open(device, channel)) {
+		printf("%-9s events not timed, %s can't be changed\n", "",
+		       channel ? channel : "no channel");
+		writer_close();
+		return;
+	}
+	long min, max;
+	snd_mixer_selem_get_playback_volume_range(m_writer_elem, &min, &max);
+
+	gint64 *times = g_new(gint64, EVENT_RUNS);
+	int count = 0;
+	int i;
+	for(i = 0; i < EVENT_RUNS; i++) {
+		long volume = min + (max - min) * (i % 2 ? 1 : 3) / 4;
+		guint reports = m_reports;
+		gint64 start = g_get_monotonic_time();
+		snd_mixer_selem_set_playback_volume_all(m_writer_elem, volume);
+		if(!wait_for_report(reports))
+			break;
+		times[count++] = g_get_monotonic_time() - start;
+	}
+	writer_close();
+
+	if(count == 0) {
+		printf("%-9s no changes were reported\n", "");
+	}
+	else {
+		qsort(times, count, sizeof(gint64), compare_times);
+		printf("%-9s events %7.2f ms until reported (median of %d, "
+		       "slowest %.2f ms)\n",
+		       "", times[count / 2] / 1000.0, count,
+		       times[count - 1] / 1000.0);
+	}
+	g_free(times);
+}
+
+static void bench_run(const Bench *bench, const gchar *device,
+                      const gchar *channel, int runs)
+{
+	long rss_start = rss_kb();
+	if(bench->prepare)
+		bench->prepare();
+
+	gint64 *times = g_new(gint64, runs);
+	int i;
+	for(i = 0; i < runs; i++) {
+		gint64 start = g_get_monotonic_time();
+		gboolean ok = bench->setup(device, channel, on_volume_changed);
+		const GList *names =
+		    ok ? wait_for_channels(bench->get_channel_names) : NULL;
+		times[i] = g_get_monotonic_time() - start;
+		if(names == NULL) {
+			printf("%-9s could not set up %s\n", bench->name, device);
+			g_free(times);
+			return;
+		}
+
+		// Let the backend handle what its setup queued up
+		while(g_main_context_iteration(NULL, FALSE))
+			;
+	}
+	qsort(times, runs, sizeof(gint64), compare_times);
+	long rss = rss_kb();
+	printf("%-9s %4u channels, setup %7.2f ms (median of %d, fastest "
+	       "%.2f ms)\n",
+	       bench->name, g_list_length((GList *)bench->get_channel_names()),
+	       times[runs / 2] / 1000.0, runs, times[0] / 1000.0);
+	printf("%-9s %6ld kB resident, %ld kB more than before setup\n", "",
+	       rss, rss - rss_start);
+	g_free(times);
+
+	bench_calls(bench);
+	bench_events(bench, device);
+	printf("%-9s %6ld kB resident after the loops\n", "", rss_kb());
+}
+
+static void bench_process(const Bench *bench, const gchar *device,
+                          const gchar *channel, int runs)
+{
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == 0) {
+		bench_run(bench, device, channel, runs);
+		fflush(stdout);
+		_exit(EXIT_SUCCESS);
+	}
+	if(pid > 0)
+		waitpid(pid, NULL, 0);
+}
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+int main(int argc, char **argv)
+{
+	const gchar *device = argc > 1 ? argv[1] : "default";
+	const gchar *channel = argc > 2 ? argv[2] : DEFAULT_CHANNEL;
+	int runs = argc > 3 ? atoi(argv[3]) : DEFAULT_RUNS;
+	if(runs < 1)
+		runs = 1;
+
+	static const Bench benches[] = {
+	    {"alsa", asound_load_channels, asound_setup,
+	     asound_get_channel_names, asound_get_channel, asound_get_volume,
+	     asound_set_volume},
+	    {"alsa-lazy", NULL, asound_setup, asound_get_channel_names,
+	     asound_get_channel, asound_get_volume, asound_set_volume},
+	    {"alsa-ctl", NULL, actl_setup, actl_get_channel_names,
+	     actl_get_channel, actl_get_volume, actl_set_volume}};
+	int i;
+	for(i = 0; i < G_N_ELEMENTS(benches); i++)
+		bench_process(&benches[i], device, channel, runs);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,108 @@
+//##############################################################################
+// volumeicon
+//
+// bench_level_icon.c - compares drawing the Level icon with loading a theme
+//                      icon
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+// Usage: bench_level_icon [SIZE [ROUNDS]]
+//
+// Times what an icon update costs when the icon isn't cached yet: drawing
+// the Level icon for every volume, against decoding and scaling every icon
+// of the tango theme like status_icon_render does. Exits with a failure if
+// drawing is the more expensive one.
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "level_icon.h"
+
+//##############################################################################
+// Definitions
+//##############################################################################
+#define DEFAULT_SIZE 24
+#define DEFAULT_ROUNDS 50
+#define ICON_COUNT 8
+
+//##############################################################################
+// Static functions
+//##############################################################################
+// Returns the time per icon in microseconds
+static double bench_theme(gint size, int rounds)
+{
+	gint64 start = g_get_monotonic_time();
+	int round, i;
+	for(round = 0; round < rounds; round++) {
+		for(i = 1; i <= ICON_COUNT; i++) {
+			gchar *path = g_strdup_printf(ICONS_SRCDIR "/tango/%d.png", i);
+			GdkPixbuf *icon = gdk_pixbuf_new_from_file(path, NULL);
+			g_free(path);
+			if(icon == NULL) {
+				printf("could not load the tango theme from %s\n",
+				       ICONS_SRCDIR);
+				exit(EXIT_FAILURE);
+			}
+			int width = gdk_pixbuf_get_width(icon);
+			int height = gdk_pixbuf_get_height(icon);
+			if(height != size) {
+				GdkPixbuf *scaled = gdk_pixbuf_scale_simple(
+				    icon, MAX(1, width * size / height), size,
+				    GDK_INTERP_BILINEAR);
+				g_object_unref(scaled);
+			}
+			g_object_unref(icon);
+		}
+	}
+	return (double)(g_get_monotonic_time() - start) / (rounds * ICON_COUNT);
+}
+
+static double bench_level(gint size, int rounds)
+{
+	gint64 start = g_get_monotonic_time();
+	int round, volume;
+	for(round = 0; round < rounds; round++) {
+		for(volume = 0; volume <= 100; volume++) {
+			GdkPixbuf *icon = level_icon_render(volume, round & 1, size);
+			g_object_unref(icon);
+		}
+	}
+	return (double)(g_get_monotonic_time() - start) / (rounds * 101);
+}
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+int main(int argc, char **argv)
+{
+	gint size = argc > 1 ? atoi(argv[1]) : DEFAULT_SIZE;
+	int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+	if(size < 1)
+		size = DEFAULT_SIZE;
+	if(rounds < 1)
+		rounds = 1;
+
+	double theme = bench_theme(size, rounds);
+	double level = bench_level(size, rounds);
+	printf("theme icon %8.2f us per update\n", theme);
+	printf("level icon %8.2f us per update (%.0f%% of theme)\n", level,
+	       level * 100 / theme);
+	return level <= theme ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,132 @@
+//##############################################################################
+// volumeicon
+//
+// test_alsa_startup.c - checks that the alsa backend doesn't hold up startup
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+#include <alsa/asoundlib.h>
+#include <glib.h>
+
+#include "alsa_backend.h"
+
+//##############################################################################
+// Definitions
+//##############################################################################
+// There's no mixer called null, so the test doesn't depend on the sound
+// cards of the machine. The cards are still enumerated.
+#define TEST_DEVICE "null"
+// Starting the mixer thread and the probes is all the background path may
+// cost on top of the blocking one, in microseconds
+#define THREAD_SLACK 10000
+#define PROBE_WAIT 5000
+
+//##############################################################################
+// Static variables
+//##############################################################################
+static gboolean m_devices_changed = FALSE;
+
+//##############################################################################
+// Static functions
+//##############################################################################
+static void on_volume_changed(int volume, gboolean mute) {}
+
+static void on_devices_changed() { m_devices_changed = TRUE; }
+
+static gboolean on_timeout(gpointer user_data)
+{
+	*(gboolean *)user_data = TRUE;
+	return FALSE;
+}
+
+static gint64 elapsed_us(gint64 start)
+{
+	return g_get_monotonic_time() - start;
+}
+
+// Opens the control device of every card one after the other, like setup
+// did before the cards were probed in the background. Returns the number of
+// cards.
+static int enumerate_cards()
+{
+	int count = 0;
+	int card = -1;
+	while(snd_card_next(&card) == 0 && card != -1) {
+		char name[16];
+		snprintf(name, sizeof(name), "hw:%d", card);
+		snd_ctl_t *ctl = NULL;
+		if(snd_ctl_open(&ctl, name, 0) >= 0) {
+			snd_ctl_card_info_t *info = NULL;
+			snd_ctl_card_info_alloca(&info);
+			snd_ctl_card_info(ctl, info);
+			snd_ctl_close(ctl);
+		}
+		count++;
+	}
+	return count;
+}
+
+static void test_startup(void)
+{
+	// Both paths get alsa-lib with its configuration already loaded
+	snd_config_update();
+
+	gint64 start = g_get_monotonic_time();
+	int cards = enumerate_cards();
+	gint64 blocking_time = elapsed_us(start);
+
+	asound_watch_devices(on_devices_changed);
+	start = g_get_monotonic_time();
+	asound_setup(TEST_DEVICE, NULL, on_volume_changed);
+	const GList *names = asound_get_device_names();
+	gint64 background_time = elapsed_us(start);
+
+	g_test_message("%d cards, probing them took %" G_GINT64_FORMAT " us, "
+	               "setup and listing the devices %" G_GINT64_FORMAT " us",
+	               cards, blocking_time, background_time);
+	g_assert_cmpint(background_time, <=, blocking_time + THREAD_SLACK);
+	g_assert_nonnull(names);
+	g_assert_cmpstr((const gchar *)names->data, ==, "default");
+
+	// The cards that were still being probed show up later on
+	guint count = g_list_length((GList *)names);
+	if(cards > 0) {
+		gboolean timed_out = FALSE;
+		guint timeout_id =
+		    g_timeout_add(PROBE_WAIT, on_timeout, &timed_out);
+		while(!m_devices_changed && !timed_out)
+			g_main_context_iteration(NULL, TRUE);
+		if(!timed_out)
+			g_source_remove(timeout_id);
+	}
+	names = asound_get_device_names();
+	g_assert_cmpstr((const gchar *)names->data, ==, "default");
+	g_assert_cmpuint(g_list_length((GList *)names), >=, count);
+	asound_close();
+}
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/alsa/startup", test_startup);
+	return g_test_run();
+}
@@ -0,0 +1,113 @@
+//##############################################################################
+// volumeicon
+//
+// test_config.c - tests for reading and validating the configuration
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "config.h"
+
+//##############################################################################
+// Static variables
+//##############################################################################
+static gchar *m_config_dir = NULL;
+
+//##############################################################################
+// Static functions
+//##############################################################################
+static void remove_tree(const gchar *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	if(dir) {
+		const gchar *name;
+		while((name = g_dir_read_name(dir))) {
+			gchar *child = g_build_filename(path, name, NULL);
+			remove_tree(child);
+			g_free(child);
+		}
+		g_dir_close(dir);
+	}
+	g_remove(path);
+}
+
+static void load_config(const gchar *name, const gchar *contents)
+{
+	gchar *path = g_build_filename(m_config_dir, "volumeicon", name, NULL);
+	GError *error = NULL;
+	g_file_set_contents(path, contents, -1, &error);
+	g_assert_no_error(error);
+	g_free(path);
+	config_initialize((gchar *)name);
+}
+
+static void test_write_interval(void)
+{
+	load_config("unset", "[Alsa]\n");
+	g_assert_cmpint(config_get_write_interval(), ==, 16);
+
+	load_config("negative", "[Alsa]\nwrite_interval=-5\n");
+	g_assert_cmpint(config_get_write_interval(), ==, 1);
+
+	load_config("huge", "[Alsa]\nwrite_interval=100000\n");
+	g_assert_cmpint(config_get_write_interval(), ==, 1000);
+
+	load_config("valid", "[Alsa]\nwrite_interval=40\n");
+	g_assert_cmpint(config_get_write_interval(), ==, 40);
+
+	config_set_write_interval(0);
+	g_assert_cmpint(config_get_write_interval(), ==, 1);
+	config_set_write_interval(G_MAXINT);
+	g_assert_cmpint(config_get_write_interval(), ==, 1000);
+}
+
+static void test_volume_curve(void)
+{
+	load_config("unset", "[Alsa]\n");
+	g_assert_cmpint(config_get_volume_curve(), ==,
+	                CONFIG_VOLUME_CURVE_ALSAMIXER);
+
+	load_config("cubic", "[Alsa]\nvolume_curve=2\n");
+	g_assert_cmpint(config_get_volume_curve(), ==, CONFIG_VOLUME_CURVE_CUBIC);
+}
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+int main(int argc, char **argv)
+{
+	// Keep the configuration of whoever runs the tests out of it
+	GError *error = NULL;
+	m_config_dir = g_dir_make_tmp("volumeicon-config-XXXXXX", &error);
+	g_assert_no_error(error);
+	g_setenv("XDG_CONFIG_HOME", m_config_dir, TRUE);
+	gchar *dir = g_build_filename(m_config_dir, "volumeicon", NULL);
+	g_mkdir(dir, 0777);
+	g_free(dir);
+
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/config/write-interval", test_write_interval);
+	g_test_add_func("/config/volume-curve", test_volume_curve);
+	int result = g_test_run();
+	remove_tree(m_config_dir);
+	g_free(m_config_dir);
+	return result;
+}
@@ -0,0 +1,238 @@
+//##############################################################################
+// volumeicon
+//
+// test_mock_backend.c - tests for the in-memory mixer and backend registry
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "mock_backend.h"
+
+//##############################################################################
+// Definitions
+//##############################################################################
+#define SCRIPT_TIMEOUT 2000
+
+//##############################################################################
+// Static variables
+//##############################################################################
+static int m_reported_volume = -1;
+static gboolean m_reported_mute = FALSE;
+static guint m_reports = 0;
+
+//##############################################################################
+// Static functions
+//##############################################################################
+static void on_volume_changed(int volume, gboolean mute)
+{
+	m_reported_volume = volume;
+	m_reported_mute = mute;
+	m_reports++;
+}
+
+static gboolean on_timeout(gpointer user_data)
+{
+	*(gboolean *)user_data = TRUE;
+	return FALSE;
+}
+
+static void assert_names(const GList *list, const gchar *const *names)
+{
+	int i;
+	for(i = 0; names[i] != NULL; i++) {
+		g_assert_nonnull(list);
+		g_assert_cmpstr((const gchar *)list->data, ==, names[i]);
+		list = g_list_next(list);
+	}
+	g_assert_null(list);
+}
+
+// The layout is only read once, so tests with their own layout run in a
+// subprocess that points the mock backend at a fresh file. The subprocess
+// inherits the environment, the file is removed again once it's done.
+static gchar *layout_create(const gchar *contents)
+{
+	GError *error = NULL;
+	gchar *path = NULL;
+	gint fd = g_file_open_tmp("volumeicon-mock-XXXXXX", &path, &error);
+	g_assert_no_error(error);
+	close(fd);
+	g_file_set_contents(path, contents, -1, &error);
+	g_assert_no_error(error);
+	g_setenv("VOLUMEICON_MOCK", path, TRUE);
+	return path;
+}
+
+static void layout_remove(gchar *path)
+{
+	g_unsetenv("VOLUMEICON_MOCK");
+	g_remove(path);
+	g_free(path);
+}
+
+static void test_default_layout(void)
+{
+	static const gchar *const devices[] = {"default", "USB", NULL};
+	static const gchar *const channels[] = {"Master", "PCM", "Headphone",
+	                                        NULL};
+	static const gchar *const usb_channels[] = {"Speaker", NULL};
+
+	g_unsetenv("VOLUMEICON_MOCK");
+	g_assert_true(mock_setup(NULL, NULL, NULL));
+	assert_names(mock_get_device_names(), devices);
+	assert_names(mock_get_channel_names(), channels);
+	g_assert_cmpstr(mock_get_device(), ==, "default");
+	g_assert_cmpstr(mock_get_channel(), ==, "Master");
+	g_assert_cmpint(mock_get_volume(), ==, 60);
+
+	g_assert_true(mock_setup("USB", "Master", NULL));
+	assert_names(mock_get_channel_names(), usb_channels);
+	g_assert_cmpstr(mock_get_channel(), ==, "Speaker");
+
+	g_assert_false(mock_setup("missing", NULL, NULL));
+	g_assert_cmpint(mock_get_volume(), ==, 0);
+	g_assert_true(mock_get_mute());
+}
+
+static void test_volume_steps(void)
+{
+	g_assert_true(mock_setup("default", "Master", NULL));
+	int volume;
+	for(volume = 0; volume <= 100; volume++) {
+		mock_set_volume(volume);
+		g_assert_cmpint(ABS(mock_get_volume() - volume), <=, 1);
+	}
+	mock_set_volume(-10);
+	g_assert_cmpint(mock_get_volume(), ==, 0);
+	mock_set_volume(150);
+	g_assert_cmpint(mock_get_volume(), ==, 100);
+}
+
+static void test_mute(void)
+{
+	// Master has a mute switch, which leaves the level alone
+	g_assert_true(mock_setup("default", "Master", NULL));
+	mock_set_volume(40);
+	int volume = mock_get_volume();
+	mock_set_mute(TRUE);
+	g_assert_true(mock_get_mute());
+	g_assert_cmpint(mock_get_volume(), ==, volume);
+	mock_set_state(70, TRUE);
+	g_assert_true(mock_get_mute());
+	g_assert_cmpint(ABS(mock_get_volume() - 70), <=, 1);
+	mock_set_state(20, FALSE);
+	g_assert_false(mock_get_mute());
+	g_assert_cmpint(ABS(mock_get_volume() - 20), <=, 1);
+
+	// PCM has none, so muting turns it all the way down
+	mock_set_channel("PCM");
+	mock_set_volume(80);
+	mock_set_mute(TRUE);
+	g_assert_false(mock_get_mute());
+	g_assert_cmpint(mock_get_volume(), ==, 0);
+}
+
+static void test_layout_file(void)
+{
+	if(g_test_subprocess()) {
+		static const gchar *const devices[] = {"card", "other", NULL};
+		static const gchar *const channels[] = {"A", "B", "C", NULL};
+		g_assert_true(mock_setup("card", "B", NULL));
+		assert_names(mock_get_device_names(), devices);
+		assert_names(mock_get_channel_names(), channels);
+		g_assert_cmpint(mock_get_volume(), ==, 20);
+		mock_set_channel("C");
+		g_assert_cmpint(mock_get_volume(), ==, 30);
+		return;
+	}
+	gchar *path =
+	    layout_create("[card/A]\nmin_dB=-30\nmax_dB=0\nvolume=10\n"
+	                  "[card/B]\nmin_dB=-30\nmax_dB=0\nvolume=20\n"
+	                  "[card/C]\nmin_dB=-30\nmax_dB=0\nvolume=30\n"
+	                  "[other/D]\nmin_dB=-30\nmax_dB=0\nvolume=40\n");
+	g_test_trap_subprocess(NULL, 0, 0);
+	layout_remove(path);
+	g_test_trap_assert_passed();
+}
+
+static void test_script(void)
+{
+	if(g_test_subprocess()) {
+		g_assert_true(mock_setup(NULL, NULL, on_volume_changed));
+
+		// The PCM event changes another channel and isn't reported
+		gboolean timed_out = FALSE;
+		g_timeout_add(SCRIPT_TIMEOUT, on_timeout, &timed_out);
+		while(m_reports < 2 && !timed_out)
+			g_main_context_iteration(NULL, TRUE);
+		g_assert_false(timed_out);
+		g_assert_cmpint(m_reports, ==, 2);
+		g_assert_cmpint(m_reported_volume, ==, 30);
+		g_assert_true(m_reported_mute);
+
+		mock_set_channel("PCM");
+		g_assert_cmpint(mock_get_volume(), ==, 90);
+		return;
+	}
+	gchar *path = layout_create("[default/Master]\nmin_dB=-30\nmax_dB=0\n"
+	                            "volume=50\nhas_mute=true\n"
+	                            "[default/PCM]\nmin_dB=-30\nmax_dB=0\n"
+	                            "volume=50\n"
+	                            "[Script]\nevents=10 volume 30;"
+	                            "10 volume 90 PCM;10 mute 1\n");
+	g_test_trap_subprocess(NULL, 0, 0);
+	layout_remove(path);
+	g_test_trap_assert_passed();
+}
+
+static void test_registry(void)
+{
+	const Backend *backend = backend_find("mock");
+	g_assert_nonnull(backend);
+	g_assert_cmpstr(backend->name, ==, "mock");
+	g_assert_true(backend->setup == mock_setup);
+	g_assert_null(backend_find("missing"));
+
+	// The mock backend has no probe, it's only picked when it's the only
+	// backend there is
+	g_assert_true(backend_probe() == backend);
+
+	gchar *names = backend_get_names();
+	g_assert_cmpstr(names, ==, "mock");
+	g_free(names);
+}
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/mock/default-layout", test_default_layout);
+	g_test_add_func("/mock/volume-steps", test_volume_steps);
+	g_test_add_func("/mock/mute", test_mute);
+	g_test_add_func("/mock/layout-file", test_layout_file);
+	g_test_add_func("/mock/script", test_script);
+	g_test_add_func("/backend/registry", test_registry);
+	return g_test_run();
+}
@@ -0,0 +1,238 @@
+//##############################################################################
+// volumeicon
+//
+// test_pulse_backend.c - tests the pulse backend against a private server
+//
+// Copyright 2011 Maato
+//
+// Authors:
+//    Maato <maato@softwarebakery.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//##############################################################################
+
+// A pulseaudio with a null sink is started on a socket of its own, so the
+// sound setup of whoever runs the tests is left alone. The tests are
+// skipped if pulseaudio isn't installed.
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "pulse_backend.h"
+
+//##############################################################################
+// Definitions
+//##############################################################################
+#define TEST_SINK "volumeicon_test"
+// Setup must only start talking to the server, never wait for it
+#define SETUP_BUDGET 50
+#define SERVER_WAIT 5000
+
+//##############################################################################
+// Static variables
+//##############################################################################
+static gchar *m_server_dir = NULL;
+static GPid m_server_pid = 0;
+static gboolean m_server_ready = FALSE;
+
+static int m_reported_volume = -1;
+static gboolean m_reported_mute = FALSE;
+static guint m_reports = 0;
+static guint m_device_reports = 0;
+
+//##############################################################################
+// Static functions
+//##############################################################################
+static void on_volume_changed(int volume, gboolean mute)
+{
+	m_reported_volume = volume;
+	m_reported_mute = mute;
+	m_reports++;
+}
+
+static void on_devices_changed() { m_device_reports++; }
+
+static gboolean on_timeout(gpointer user_data)
+{
+	*(gboolean *)user_data = TRUE;
+	return FALSE;
+}
+
+// Runs the main loop until *counter goes past count, FALSE on timeout
+static gboolean wait_for(const guint *counter, guint count)
+{
+	gboolean timed_out = FALSE;
+	guint timeout_id = g_timeout_add(SERVER_WAIT, on_timeout, &timed_out);
+	while(*counter <= count && !timed_out)
+		g_main_context_iteration(NULL, TRUE);
+	if(!timed_out)
+		g_source_remove(timeout_id);
+	return !timed_out;
+}
+
+static void remove_tree(const gchar *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	if(dir) {
+		const gchar *name;
+		while((name = g_dir_read_name(dir))) {
+			gchar *child = g_build_filename(path, name, NULL);
+			remove_tree(child);
+			g_free(child);
+		}
+		g_dir_close(dir);
+	}
+	g_remove(path);
+}
+
+static gboolean server_start()
+{
+	GError *error = NULL;
+	m_server_dir = g_dir_make_tmp("volumeicon-pulse-XXXXXX", &error);
+	g_assert_no_error(error);
+
+	gchar *socket = g_build_filename(m_server_dir, "native", NULL);
+	gchar *socket_arg = g_strdup_printf(
+	    "--load=module-native-protocol-unix auth-anonymous=1 socket=%s",
+	    socket);
+	gchar *argv[] = {"pulseaudio", "--daemonize=no", "-n",
+	                 "--exit-idle-time=-1", "--use-pid-file=no",
+	                 "--log-level=error", socket_arg,
+	                 "--load=module-null-sink sink_name=" TEST_SINK, NULL};
+	gchar **envp = g_get_environ();
+	envp = g_environ_setenv(envp, "HOME", m_server_dir, TRUE);
+	envp = g_environ_setenv(envp, "XDG_RUNTIME_DIR", m_server_dir, TRUE);
+	envp = g_environ_setenv(envp, "XDG_CONFIG_HOME", m_server_dir, TRUE);
+	gboolean started = g_spawn_async(NULL, argv, envp,
+	                                 G_SPAWN_SEARCH_PATH |
+	                                     G_SPAWN_DO_NOT_REAP_CHILD,
+	                                 NULL, NULL, &m_server_pid, NULL);
+	g_strfreev(envp);
+	g_free(socket_arg);
+
+	// The socket shows up once the server is ready for us
+	gint64 deadline =
+	    g_get_monotonic_time() + SERVER_WAIT * G_TIME_SPAN_MILLISECOND;
+	while(started && !g_file_test(socket, G_FILE_TEST_EXISTS) &&
+	      g_get_monotonic_time() < deadline)
+		g_usleep(10 * G_TIME_SPAN_MILLISECOND);
+	started = started && g_file_test(socket, G_FILE_TEST_EXISTS);
+
+	gchar *server = g_strdup_printf("unix:%s", socket);
+	g_setenv("PULSE_SERVER", server, TRUE);
+	g_free(server);
+	g_free(socket);
+	return started;
+}
+
+static void server_stop()
+{
+	if(m_server_pid) {
+		kill(m_server_pid, SIGTERM);
+		waitpid(m_server_pid, NULL, 0);
+		g_spawn_close_pid(m_server_pid);
+	}
+	remove_tree(m_server_dir);
+	g_free(m_server_dir);
+}
+
+// Sets the test sink up from scratch and waits for its volume
+static void setup_sink()
+{
+	guint reports = m_reports;
+	gint64 start = g_get_monotonic_time();
+	g_assert_true(pulse_setup(TEST_SINK, NULL, on_volume_changed));
+	gint64 setup_time =
+	    (g_get_monotonic_time() - start) / G_TIME_SPAN_MILLISECOND;
+	g_assert_cmpint(setup_time, <, SETUP_BUDGET);
+	g_assert_true(wait_for(&m_reports, reports));
+}
+
+static void test_setup(void)
+{
+	if(!m_server_ready) {
+		g_test_skip("pulseaudio isn't available");
+		return;
+	}
+	g_assert_true(pulse_probe());
+	pulse_watch_devices(on_devices_changed);
+	setup_sink();
+	g_assert_cmpstr(pulse_get_device(), ==, TEST_SINK);
+	g_assert_cmpstr(pulse_get_channel(), ==, "Master");
+	g_assert_cmpint(m_reported_volume, ==, pulse_get_volume());
+
+	if(m_device_reports == 0)
+		g_assert_true(wait_for(&m_device_reports, 0));
+	const GList *names = pulse_get_device_names();
+	g_assert_cmpstr((const gchar *)names->data, ==, "default");
+	g_assert_nonnull(g_list_find_custom((GList *)names, TEST_SINK,
+	                                    (GCompareFunc)g_strcmp0));
+}
+
+// Writes are fire and forget, close waits for them before disconnecting
+static void test_write(void)
+{
+	if(!m_server_ready) {
+		g_test_skip("pulseaudio isn't available");
+		return;
+	}
+	int volumes[] = {40, 130, 0};
+	int i;
+	for(i = 0; i < G_N_ELEMENTS(volumes); i++) {
+		pulse_set_state(volumes[i], i % 2 == 0);
+		pulse_close();
+		setup_sink();
+		g_assert_cmpint(m_reported_volume, ==, volumes[i]);
+		g_assert_cmpint(m_reported_mute, ==, i % 2 == 0);
+	}
+}
+
+// Changes made by others come in through the subscription
+static void test_external_change(void)
+{
+	if(!m_server_ready) {
+		g_test_skip("pulseaudio isn't available");
+		return;
+	}
+	gchar *pactl = g_find_program_in_path("pactl");
+	if(pactl == NULL) {
+		g_test_skip("pactl isn't available");
+		return;
+	}
+	g_free(pactl);
+
+	guint reports = m_reports;
+	g_assert_true(g_spawn_command_line_sync(
+	    "pactl set-sink-volume " TEST_SINK " 25%", NULL, NULL, NULL, NULL));
+	g_assert_true(wait_for(&m_reports, reports));
+	g_assert_cmpint(m_reported_volume, ==, 25);
+	g_assert_cmpint(pulse_get_volume(), ==, 25);
+}
+
+//##############################################################################
+// Exported functions
+//##############################################################################
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	m_server_ready = server_start();
+	g_test_add_func("/pulse/setup", test_setup);
+	g_test_add_func("/pulse/write", test_write);
+	g_test_add_func("/pulse/external-change", test_external_change);
+	int result = g_test_run();
+	pulse_close();
+	server_stop();
+	return result;
+}
@@ -24,6 +24,7 @@
 #include <assert.h>
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
+#include <glib-unix.h>
 #include <gtk/gtk.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -35,12 +36,9 @@
 #endif
 #include <libnotify/notify.h>
 #endif
-#ifdef COMPILEWITH_OSS
-#include "oss_backend.h"
-#else
-#include "alsa_backend.h"
-#endif
+#include "backend.h"
 #include "config.h"
+#include "level_icon.h"
 #include "keybinder.h"
 
 enum HOTKEY { UP, DOWN, MUTE };
@@ -56,10 +54,14 @@ enum NOTIFICATION {
 //##############################################################################
 // Definitions
 //##############################################################################
-// Resources
-#define PREFERENCES_UI_FILE DATADIR "/gui/preferences.ui"
+// Resources, compiled into the binary from data/volumeicon.gresource.xml
+#define RESOURCE_PATH "/org/volumeicon"
+#define PREFERENCES_UI_RESOURCE RESOURCE_PATH "/gui/preferences.ui"
+#define ICONS_RESOURCE RESOURCE_PATH "/icons"
+#define APP_ICON_RESOURCE RESOURCE_PATH "/gui/appicon.svg"
+
+// Themes that didn't come with volumeicon are read from here
 #define ICONS_DIR DATADIR "/icons"
-#define APP_ICON DATADIR "/gui/appicon.svg"
 
 // About
 #define APPNAME "Volume Icon"
@@ -67,12 +69,12 @@ enum NOTIFICATION {
 #define COMMENTS "Volume control for your system tray."
 #define WEBSITE "http://nullwise.com/volumeicon.html"
 
-// Scale constants
+// Scale constants, milliseconds the slider stays after the pointer left it
 #define SCALE_HIDE_DELAY 500
-#define TIMER_INTERVAL 50
 
-// Setup retry
-#define SETUP_RETRY_INTERVAL 1000
+// Hotplug, milliseconds to wait for device nodes to settle before setup is
+// retried
+#define HOTPLUG_SETTLE_DELAY 100
 
 //##############################################################################
 // Type definitions
@@ -94,6 +96,7 @@ typedef struct {
 	GtkButton *close_button;
 	GtkRadioButton *linear_scale_radiobutton;
 	GtkRadioButton *logarithmic_scale_radiobutton;
+	GtkRadioButton *cubic_scale_radiobutton;
 	GtkRadioButton *mute_radiobutton;
 	GtkRadioButton *slider_radiobutton;
 	GtkRadioButton *mmb_mute_radiobutton;
@@ -112,7 +115,12 @@ typedef struct {
 // Static variables
 //##############################################################################
 static gboolean m_backend_is_setup = FALSE;
+static gboolean m_channel_pending = FALSE; // setup hasn't picked one yet
+static GFileMonitor *m_hotplug_monitor = NULL;
+static guint m_hotplug_timeout_id = 0;
+static gboolean m_hotplug_removed = FALSE;
 static gchar *m_commandline_device_name = NULL;
+static gchar *m_commandline_backend_name = NULL;
 #ifdef COMPILEWITH_NOTIFY
 static NotifyNotification *m_notification = NULL;
 #endif
@@ -120,6 +128,7 @@ static GtkWindow *m_popup_window = NULL;
 static GtkImage *m_popup_icon = NULL;
 static GtkProgressBar *m_pbar = NULL;
 static guint m_timeout_id = 0;
+static guint m_scale_hide_id = 0;
 
 static GtkStatusIcon *m_status_icon = NULL;
 static GtkWidget *m_scale_window = NULL;
@@ -128,25 +137,44 @@ static gboolean m_setting_scale_value = FALSE;
 static PreferencesGui *gui = NULL;
 
 // Backend Interface
-static gboolean (*backend_setup)(const gchar *card, const gchar *channel,
-                                 void (*volume_changed)(int, gboolean)) = NULL;
-static void (*backend_set_channel)(const gchar *channel) = NULL;
-static void (*backend_set_volume)(int volume) = NULL;
-static void (*backend_set_mute)(gboolean mute) = NULL;
-static int (*backend_get_volume)(void) = NULL;
-static gboolean (*backend_get_mute)(void) = NULL;
-static const gchar *(*backend_get_channel)(void) = NULL;
-static const GList *(*backend_get_channel_names)(void) = NULL;
-static const gchar *(*backend_get_device)(void) = NULL;
-static const GList *(*backend_get_device_names)(void) = NULL;
+static const Backend *m_backend = NULL;
 
 // Status
 static int m_volume = 0;
 static gboolean m_mute = FALSE;
 
+// Pending backend write, see volume_write().
+static struct {
+	int volume;
+	gboolean mute;
+	gboolean write_mute;
+	gboolean pending;
+	guint timeout_id;
+	guint requested;
+	guint issued;
+} m_write = {0, FALSE, FALSE, FALSE, 0, 0, 0};
+
 // Icons
 #define ICON_COUNT 8
-static GdkPixbuf *m_icons[ICON_COUNT];
+#define ICON_DEFAULT_SIZE 24
+
+// Theme icons are decoded when they are first shown at a panel size, only
+// their copy at that size is kept in m_icon_cache.
+static guint m_icons_failed = 0; // bit per icon that couldn't be loaded
+
+// The THEME_LEVEL theme draws the exact volume, the drawn icons are kept for
+// reuse keyed by size, volume and mute.
+#define LEVEL_CACHE_SIZE 16
+static struct {
+	GHashTable *pixbufs;
+	GQueue lru; // keys, most recent first
+} m_level_cache = {NULL, G_QUEUE_INIT};
+
+// Status icon images, looked up and scaled to the panel size once
+static struct {
+	GdkPixbuf *pixbufs[ICON_COUNT];
+	gint size;
+} m_icon_cache = {{NULL}, 0};
 
 //##############################################################################
 // Function prototypes
@@ -154,7 +182,8 @@ static GdkPixbuf *m_icons[ICON_COUNT];
 static void volume_icon_on_volume_changed(int volume, gboolean mute);
 static void status_icon_update(gboolean mute, gboolean force);
 static void hotkey_handle(const char *key, void *user_data);
-static void volume_icon_load_icons();
+static void volume_icon_reset_icons();
+static GdkPixbuf *volume_icon_get_icon(int icon_number);
 static void scale_update();
 static void notification_show();
 
@@ -166,24 +195,90 @@ static inline int clamp_volume(int value)
 {
 	if(value < 0)
 		return 0;
+	if(m_backend->caps & BACKEND_CAP_BOOST)
+		return MIN(value, BACKEND_VOLUME_BOOST_MAX);
 	if(value > 100)
 		return 100;
 	return value;
 }
 
+// Stepping up stops at 100%, only a boost that was set elsewhere is kept
+static inline int step_volume(int step)
+{
+	return MIN(clamp_volume(m_volume + step), MAX(m_volume, 100));
+}
+
+// Writes to the backend are rate limited to one per write_interval. The first
+// write goes out immediately, anything requested while the interval runs only
+// updates the target which is then written when the interval ends.
+static void volume_write_flush()
+{
+	if(!m_write.pending)
+		return;
+	m_write.pending = FALSE;
+	m_write.issued++;
+
+	if(m_write.write_mute) {
+		m_write.write_mute = FALSE;
+		m_backend->set_state(m_write.volume, m_write.mute);
+	}
+	else {
+		m_backend->set_volume(m_write.volume);
+	}
+}
+
+static gboolean volume_write_timeout(gpointer user_data)
+{
+	if(m_write.pending) {
+		volume_write_flush();
+		return TRUE;
+	}
+	m_write.timeout_id = 0;
+	return FALSE;
+}
+
+// Queue a write of m_volume and, if write_mute is set, m_mute.
+static void volume_write(gboolean write_mute)
+{
+	m_write.requested++;
+	m_write.volume = m_volume;
+	m_write.mute = m_mute;
+	m_write.write_mute = m_write.write_mute || write_mute;
+	m_write.pending = TRUE;
+
+	if(m_write.timeout_id == 0) {
+		volume_write_flush();
+		m_write.timeout_id = g_timeout_add(config_get_write_interval(),
+		                                   volume_write_timeout, NULL);
+	}
+}
+
+static gboolean diagnostics_dump(gpointer user_data)
+{
+	g_fprintf(stderr, "Backend writes: %u requested, %u issued\n",
+	          m_write.requested, m_write.issued);
+	if(m_backend->caps & BACKEND_CAP_DIAGNOSTICS)
+		m_backend->print_diagnostics();
+	return TRUE;
+}
+
 static void populate_device_model_and_combobox(PreferencesGui *gui)
 {
 	// Clean existing data
 	gtk_list_store_clear(gui->device_store);
 
 	// Fill the channel model and combobox
+	gtk_widget_set_sensitive(GTK_WIDGET(gui->device_combobox),
+	                         m_backend->caps & BACKEND_CAP_DEVICES);
+	if(!(m_backend->caps & BACKEND_CAP_DEVICES))
+		return;
 	GtkTreeIter tree_iter;
-	const GList *list_iter = backend_get_device_names();
+	const GList *list_iter = m_backend->get_device_names();
 	while(list_iter) {
 		gtk_list_store_append(gui->device_store, &tree_iter);
 		gtk_list_store_set(gui->device_store, &tree_iter, 0,
 		                   (gchar *)list_iter->data, -1);
-		if(g_strcmp0((gchar *)list_iter->data, backend_get_device()) == 0)
+		if(g_strcmp0((gchar *)list_iter->data, m_backend->get_device()) == 0)
 			gtk_combo_box_set_active_iter(gui->device_combobox, &tree_iter);
 		list_iter = g_list_next(list_iter);
 	}
@@ -196,12 +291,12 @@ static void populate_channel_model_and_combobox(PreferencesGui *gui)
 
 	// Fill the channel model and combobox
 	GtkTreeIter tree_iter;
-	const GList *list_iter = backend_get_channel_names();
+	const GList *list_iter = m_backend->get_channel_names();
 	while(list_iter) {
 		gtk_list_store_append(gui->channel_store, &tree_iter);
 		gtk_list_store_set(gui->channel_store, &tree_iter, 0,
 		                   (gchar *)list_iter->data, -1);
-		if(g_strcmp0((gchar *)list_iter->data, backend_get_channel()) == 0)
+		if(g_strcmp0((gchar *)list_iter->data, m_backend->get_channel()) == 0)
 			gtk_combo_box_set_active_iter(gui->channel_combobox, &tree_iter);
 		list_iter = g_list_next(list_iter);
 	}
@@ -229,17 +324,24 @@ static void preferences_close_button_clicked(GtkWidget *widget,
 	gtk_widget_destroy(gui->window);
 }
 
-static void preferences_logarithmic_scale_radiobutton_toggled(
-    GtkToggleButton *togglebutton, gpointer user_data)
+static void
+preferences_scale_radiobutton_toggled(GtkToggleButton *togglebutton,
+                                      gpointer user_data)
 {
-	gboolean use_logarithmic_scale =
-	    gtk_toggle_button_get_active(togglebutton);
-	config_set_use_logarithmic_scale(use_logarithmic_scale);
-
-	m_volume = clamp_volume(backend_get_volume());
-	m_mute = backend_get_mute();
-	status_icon_update(m_mute, TRUE);
-	scale_update();
+	// The button turned off is toggled too
+	if(!gtk_toggle_button_get_active(togglebutton))
+		return;
+	GtkRadioButton *button = GTK_RADIO_BUTTON(togglebutton);
+	config_set_use_logarithmic_scale(button ==
+	                                 gui->logarithmic_scale_radiobutton);
+	config_set_volume_curve(button == gui->cubic_scale_radiobutton ?
+	                            CONFIG_VOLUME_CURVE_CUBIC :
+	                            CONFIG_VOLUME_CURVE_ALSAMIXER);
+
+	// The volume on the new scale comes in through
+	// volume_icon_on_volume_changed
+	if(m_backend->reload_config)
+		m_backend->reload_config();
 }
 
 static void preferences_mute_radiobutton_toggled(GtkToggleButton *togglebutton,
@@ -296,7 +398,7 @@ static void preferences_theme_combobox_changed(GtkComboBox *widget,
 		    GTK_WIDGET(gui->use_panel_specific_icons_checkbutton),
 		    config_get_use_gtk_theme());
 	}
-	volume_icon_load_icons();
+	volume_icon_reset_icons();
 	status_icon_update(m_mute, TRUE);
 }
 
@@ -308,14 +410,20 @@ static void preferences_device_combobox_changed(GtkComboBox *widget,
 		gchar *device;
 		gtk_tree_model_get(GTK_TREE_MODEL(gui->device_store), &iter, 0,
 		                   &device, -1);
+		volume_write_flush();
 		m_backend_is_setup =
-		    backend_setup(device, NULL, volume_icon_on_volume_changed);
+		    m_backend->setup(device, NULL, volume_icon_on_volume_changed);
 		config_set_card(device);
-		config_set_channel(backend_get_channel());
-		m_volume = clamp_volume(backend_get_volume());
-		m_mute = backend_get_mute();
 		g_free(device);
 
+		// A backend which sets up in the background tells the channel it
+		// picked along with the state, see volume_icon_on_volume_changed.
+		m_channel_pending = m_backend->get_channel() == NULL;
+		if(!m_channel_pending) {
+			config_set_channel(m_backend->get_channel());
+			m_volume = clamp_volume(m_backend->get_volume());
+			m_mute = m_backend->get_mute();
+		}
 		populate_channel_model_and_combobox(gui);
 	}
 }
@@ -330,14 +438,23 @@ static void preferences_channel_combobox_changed(GtkComboBox *widget,
 		gchar *channel;
 		gtk_tree_model_get(GTK_TREE_MODEL(gui->channel_store), &iter, 0,
 		                   &channel, -1);
-		backend_set_channel(channel);
+		// The state of the new channel comes in through
+		// volume_icon_on_volume_changed
+		volume_write_flush();
+		m_backend->set_channel(channel);
 		config_set_channel(channel);
 		g_free(channel);
-		m_volume = clamp_volume(backend_get_volume());
-		m_mute = backend_get_mute();
 	}
-	status_icon_update(m_mute, TRUE);
-	scale_update();
+}
+
+// Refills the channel combobox without switching the channel
+static void preferences_reload_channels()
+{
+	g_signal_handlers_block_by_func(
+	    gui->channel_combobox, preferences_channel_combobox_changed, NULL);
+	populate_channel_model_and_combobox(gui);
+	g_signal_handlers_unblock_by_func(
+	    gui->channel_combobox, preferences_channel_combobox_changed, NULL);
 }
 
 static void preferences_volume_adjustment_changed(GtkSpinButton *spinbutton,
@@ -489,6 +606,18 @@ static void preferences_notification_combobox_changed(GtkComboBox *widget,
 }
 
 // Menu handlers
+// Themes are shown by their label, or by their name if label is NULL
+static void preferences_theme_add(PreferencesGui *gui, const gchar *name,
+                                  const gchar *label)
+{
+	GtkTreeIter tree_iter;
+	gtk_list_store_append(gui->theme_store, &tree_iter);
+	gtk_list_store_set(gui->theme_store, &tree_iter, 0, name, 1,
+	                   label ? label : name, -1);
+	if(g_strcmp0(name, config_get_theme()) == 0)
+		gtk_combo_box_set_active_iter(gui->theme_combobox, &tree_iter);
+}
+
 static void menu_preferences_on_activate(GtkMenuItem *menuitem,
                                          gpointer user_data)
 {
@@ -500,7 +629,7 @@ static void menu_preferences_on_activate(GtkMenuItem *menuitem,
 	gui = (PreferencesGui *)g_malloc(sizeof *gui);
 
 	gui->builder = gtk_builder_new();
-	gtk_builder_add_from_file(gui->builder, PREFERENCES_UI_FILE, NULL);
+	gtk_builder_add_from_resource(gui->builder, PREFERENCES_UI_RESOURCE, NULL);
 
 // Get widgets from builder
 #define getobj(x) gtk_builder_get_object(gui->builder, x)
@@ -523,6 +652,8 @@ static void menu_preferences_on_activate(GtkMenuItem *menuitem,
 	    GTK_RADIO_BUTTON(getobj("linear_scale_radiobutton"));
 	gui->logarithmic_scale_radiobutton =
 	    GTK_RADIO_BUTTON(getobj("logarithmic_scale_radiobutton"));
+	gui->cubic_scale_radiobutton =
+	    GTK_RADIO_BUTTON(getobj("cubic_scale_radiobutton"));
 	gui->mute_radiobutton = GTK_RADIO_BUTTON(getobj("mute_radiobutton"));
 	gui->slider_radiobutton = GTK_RADIO_BUTTON(getobj("slider_radiobutton"));
 	gui->mmb_mute_radiobutton =
@@ -547,13 +678,22 @@ static void menu_preferences_on_activate(GtkMenuItem *menuitem,
 #undef getobj
 
 	// Set the window icon
-	gtk_window_set_default_icon_from_file(APP_ICON, NULL);
+	GdkPixbuf *app_icon =
+	    gdk_pixbuf_new_from_resource(APP_ICON_RESOURCE, NULL);
+	if(app_icon) {
+		gtk_window_set_default_icon(app_icon);
+		g_object_unref(app_icon);
+	}
 
 	// Set the radiobuttons
 	if(config_get_use_logarithmic_scale()) {
 		gtk_toggle_button_set_active(
 		    GTK_TOGGLE_BUTTON(gui->logarithmic_scale_radiobutton), TRUE);
 	}
+	else if(config_get_volume_curve() == CONFIG_VOLUME_CURVE_CUBIC) {
+		gtk_toggle_button_set_active(
+		    GTK_TOGGLE_BUTTON(gui->cubic_scale_radiobutton), TRUE);
+	}
 	else {
 		gtk_toggle_button_set_active(
 		    GTK_TOGGLE_BUTTON(gui->linear_scale_radiobutton), TRUE);
@@ -593,27 +733,45 @@ static void menu_preferences_on_activate(GtkMenuItem *menuitem,
 	    GTK_TOGGLE_BUTTON(gui->show_notification_checkbutton),
 	    config_get_show_notification());
 
+	// The backend might have only loaded the channel we're using, the
+	// others come in through volume_icon_on_devices_changed
+	if(m_backend->load_channels)
+		m_backend->load_channels();
 	populate_device_model_and_combobox(gui);
 	populate_channel_model_and_combobox(gui);
 
 	// Fill the theme name model and combobox
 	GtkTreeIter tree_iter;
 	gtk_list_store_append(gui->theme_store, &tree_iter);
-	gtk_list_store_set(gui->theme_store, &tree_iter, 0, "Default", -1);
+	gtk_list_store_set(gui->theme_store, &tree_iter, 0, "Default", 1,
+	                   "Default", -1);
 	gboolean use_gtk_theme = config_get_use_gtk_theme();
 	if(use_gtk_theme)
 		gtk_combo_box_set_active_iter(gui->theme_combobox, &tree_iter);
+	preferences_theme_add(gui, THEME_LEVEL, _("Level"));
+	gchar **bundled = g_resources_enumerate_children(
+	    ICONS_RESOURCE, G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+	GHashTable *themes = g_hash_table_new(g_str_hash, g_str_equal);
+	int i;
+	for(i = 0; bundled && bundled[i]; i++) {
+		// Directories are listed with a trailing slash
+		gchar *slash = g_strrstr(bundled[i], "/");
+		if(slash)
+			*slash = '\0';
+		preferences_theme_add(gui, bundled[i], NULL);
+		g_hash_table_add(themes, bundled[i]);
+	}
 	GDir *themedir = g_dir_open(ICONS_DIR, 0, NULL);
 	if(themedir) {
 		const gchar *name;
 		while((name = g_dir_read_name(themedir))) {
-			gtk_list_store_append(gui->theme_store, &tree_iter);
-			gtk_list_store_set(gui->theme_store, &tree_iter, 0, name, -1);
-			if(g_strcmp0(name, config_get_theme()) == 0)
-				gtk_combo_box_set_active_iter(gui->theme_combobox, &tree_iter);
+			if(!g_hash_table_contains(themes, name))
+				preferences_theme_add(gui, name, NULL);
 		}
 		g_dir_close(themedir);
 	}
+	g_hash_table_destroy(themes);
+	g_strfreev(bundled);
 	gtk_widget_set_sensitive(
 	    GTK_WIDGET(gui->use_panel_specific_icons_checkbutton), use_gtk_theme);
 	gtk_toggle_button_set_active(
@@ -684,9 +842,12 @@ static void menu_preferences_on_activate(GtkMenuItem *menuitem,
 	    G_OBJECT(gui->reverse_scroll_direction_checkbutton), "toggled",
 	    G_CALLBACK(preferences_reverse_scroll_direction_checkbutton_toggled),
 	    NULL);
-	g_signal_connect(
-	    G_OBJECT(gui->logarithmic_scale_radiobutton), "toggled",
-	    G_CALLBACK(preferences_logarithmic_scale_radiobutton_toggled), NULL);
+	g_signal_connect(G_OBJECT(gui->linear_scale_radiobutton), "toggled",
+	                 G_CALLBACK(preferences_scale_radiobutton_toggled), NULL);
+	g_signal_connect(G_OBJECT(gui->logarithmic_scale_radiobutton), "toggled",
+	                 G_CALLBACK(preferences_scale_radiobutton_toggled), NULL);
+	g_signal_connect(G_OBJECT(gui->cubic_scale_radiobutton), "toggled",
+	                 G_CALLBACK(preferences_scale_radiobutton_toggled), NULL);
 	g_signal_connect(G_OBJECT(gui->mute_radiobutton), "toggled",
 	                 G_CALLBACK(preferences_mute_radiobutton_toggled), NULL);
 	g_signal_connect(G_OBJECT(gui->mmb_mixer_radiobutton), "toggled",
@@ -730,8 +891,9 @@ static void menu_about_on_activate(GtkMenuItem *menuitem, gpointer user_data)
 	GtkWidget *aboutDialog = gtk_about_dialog_new();
 	gtk_about_dialog_set_program_name(GTK_ABOUT_DIALOG(aboutDialog), APPNAME);
 	gtk_about_dialog_set_version(GTK_ABOUT_DIALOG(aboutDialog), VERSION);
-	gtk_about_dialog_set_logo(GTK_ABOUT_DIALOG(aboutDialog),
-	                          gdk_pixbuf_new_from_file(APP_ICON, NULL));
+	gtk_about_dialog_set_logo(
+	    GTK_ABOUT_DIALOG(aboutDialog),
+	    gdk_pixbuf_new_from_resource(APP_ICON_RESOURCE, NULL));
 	gtk_about_dialog_set_copyright(GTK_ABOUT_DIALOG(aboutDialog), COPYRIGHT);
 	gtk_about_dialog_set_comments(GTK_ABOUT_DIALOG(aboutDialog), COMMENTS);
 	gtk_about_dialog_set_website(GTK_ABOUT_DIALOG(aboutDialog), WEBSITE);
@@ -761,42 +923,120 @@ static gboolean scale_point_in_rect(GdkRectangle *rect, gint x, gint y)
 	        y <= rect->y + rect->height);
 }
 
-static gboolean scale_timeout(gpointer data)
+// The status icon has no enter and leave events of its own. While the slider
+// is shown the pointer is grabbed with owner events, so motion outside our
+// windows is reported to the slider and can be checked against the icon.
+static gboolean scale_point_on_icon(gint x, gint y)
 {
-	static int counter = SCALE_HIDE_DELAY;
-	GdkRectangle window;
 	GdkRectangle icon;
+	if(!gtk_status_icon_get_geometry(m_status_icon, NULL, &icon, NULL))
+		return FALSE;
+	return scale_point_in_rect(&icon, x, y);
+}
 
-	gtk_window_get_position(GTK_WINDOW(m_scale_window), &window.x, &window.y);
-	gtk_window_get_size(GTK_WINDOW(m_scale_window), &window.width,
-	                    &window.height);
-	gtk_status_icon_get_geometry(m_status_icon, NULL, &icon, NULL);
-
-	GdkWindow *root_window;
-	GdkDeviceManager *device_manager;
-	GdkDevice *pointer;
-	gint x, y;
-
-	root_window =
-	    gdk_screen_get_root_window(gtk_widget_get_screen(m_scale_window));
-	device_manager =
-	    gdk_display_get_device_manager(gdk_window_get_display(root_window));
-	pointer = gdk_device_manager_get_client_pointer(device_manager);
-	gdk_window_get_device_position(root_window, pointer, &x, &y, NULL);
-
-	if(scale_point_in_rect(&window, x, y) ||
-	   scale_point_in_rect(&icon, x, y)) {
-		counter = SCALE_HIDE_DELAY;
-		return TRUE;
+static gboolean scale_point_on_window(gint x, gint y)
+{
+	GdkRectangle window;
+	gdk_window_get_frame_extents(gtk_widget_get_window(m_scale_window),
+	                             &window);
+	return scale_point_in_rect(&window, x, y);
+}
+
+static GdkDevice *scale_get_pointer()
+{
+	GdkDeviceManager *device_manager = gdk_display_get_device_manager(
+	    gtk_widget_get_display(m_scale_window));
+	return gdk_device_manager_get_client_pointer(device_manager);
+}
+
+static gboolean scale_hide_timeout(gpointer data)
+{
+	m_scale_hide_id = 0;
+	gtk_widget_hide(m_scale_window);
+	return FALSE;
+}
+
+static void scale_hide_cancel()
+{
+	if(m_scale_hide_id) {
+		g_source_remove(m_scale_hide_id);
+		m_scale_hide_id = 0;
 	}
-	else if(counter > 0) {
-		counter -= TIMER_INTERVAL;
+}
+
+// Hides the slider after SCALE_HIDE_DELAY unless the pointer comes back
+static void scale_hide_schedule()
+{
+	if(m_scale_hide_id == 0) {
+		m_scale_hide_id =
+		    g_timeout_add(SCALE_HIDE_DELAY, scale_hide_timeout, NULL);
+	}
+}
+
+// Only the pointer leaving both the slider and the icon hides the slider
+static void scale_pointer_moved(gint x, gint y)
+{
+	if(scale_point_on_window(x, y) || scale_point_on_icon(x, y))
+		scale_hide_cancel();
+	else
+		scale_hide_schedule();
+}
+
+static gboolean scale_on_enter(GtkWidget *widget, GdkEventCrossing *event,
+                               gpointer user_data)
+{
+	scale_hide_cancel();
+	return FALSE;
+}
+
+static gboolean scale_on_leave(GtkWidget *widget, GdkEventCrossing *event,
+                               gpointer user_data)
+{
+	// Moving onto the slider itself doesn't leave the window
+	if(event->detail != GDK_NOTIFY_INFERIOR)
+		scale_pointer_moved((gint)event->x_root, (gint)event->y_root);
+	return FALSE;
+}
+
+static gboolean scale_on_motion(GtkWidget *widget, GdkEventMotion *event,
+                                gpointer user_data)
+{
+	scale_pointer_moved((gint)event->x_root, (gint)event->y_root);
+	return FALSE;
+}
+
+// A click outside of the slider and the icon closes the slider right away,
+// clicks on the icon are handled by status_icon_on_button_press.
+static gboolean scale_on_button_press(GtkWidget *widget, GdkEventButton *event,
+                                      gpointer user_data)
+{
+	gint x = (gint)event->x_root, y = (gint)event->y_root;
+	if(!scale_point_on_window(x, y) && !scale_point_on_icon(x, y)) {
+		gtk_widget_hide(m_scale_window);
 		return TRUE;
 	}
-	gtk_widget_hide(m_scale_window);
 	return FALSE;
 }
 
+static gboolean scale_on_map(GtkWidget *widget, GdkEvent *event,
+                             gpointer user_data)
+{
+	// Without the grab the slider still hides when the pointer leaves it
+	gdk_device_grab(scale_get_pointer(), gtk_widget_get_window(widget),
+	                GDK_OWNERSHIP_NONE, TRUE,
+	                GDK_POINTER_MOTION_MASK | GDK_BUTTON_PRESS_MASK |
+	                    GDK_BUTTON_RELEASE_MASK | GDK_ENTER_NOTIFY_MASK |
+	                    GDK_LEAVE_NOTIFY_MASK,
+	                NULL, GDK_CURRENT_TIME);
+	return FALSE;
+}
+
+static void scale_on_hide(GtkWidget *widget, gpointer user_data)
+{
+	scale_hide_cancel();
+	gdk_device_ungrab(scale_get_pointer(), GDK_CURRENT_TIME);
+}
+
 // StatusIcon handlers
 static gboolean status_icon_on_button_press(GtkStatusIcon *status_icon,
                                             GdkEventButton *event,
@@ -836,13 +1076,11 @@ static gboolean status_icon_on_button_press(GtkStatusIcon *status_icon,
 
 		gtk_window_move(GTK_WINDOW(m_scale_window), x, y);
 		gtk_window_present_with_time(GTK_WINDOW(m_scale_window), event->time);
-		g_timeout_add(TIMER_INTERVAL, scale_timeout, NULL);
 	}
 	else if((event->button == 1 && !config_get_left_mouse_slider()) ||
 	        (event->button == 2 && config_get_middle_mouse_mute())) {
 		m_mute = !m_mute;
-		backend_set_volume(m_volume);
-		backend_set_mute(m_mute);
+		volume_write(TRUE);
 		status_icon_update(m_mute, FALSE);
 		notification_show();
 	}
@@ -869,20 +1107,22 @@ static void status_icon_on_scroll_event(GtkStatusIcon *status_icon,
 	switch(event->direction) {
 	case(GDK_SCROLL_UP):
 	case(GDK_SCROLL_RIGHT):
-		m_volume = clamp_volume(m_volume + stepsize);
+		m_volume = step_volume(stepsize);
 		break;
 	case(GDK_SCROLL_DOWN):
 	case(GDK_SCROLL_LEFT):
-		m_volume = clamp_volume(m_volume - stepsize);
+		m_volume = step_volume(-stepsize);
 		break;
 	default:
 		break;
 	}
 
-	backend_set_volume(m_volume);
 	if(m_mute) {
 		m_mute = FALSE;
-		backend_set_mute(m_mute);
+		volume_write(TRUE);
+	}
+	else {
+		volume_write(FALSE);
 	}
 	status_icon_update(m_mute, FALSE);
 	scale_update();
@@ -947,48 +1187,139 @@ static int status_icon_get_number(int volume, gboolean mute)
 	return 8;
 }
 
+static const gchar *status_icon_get_name(int icon_number)
+{
+	if(icon_number == 1)
+		return "audio-volume-muted";
+	if(icon_number <= 3)
+		return "audio-volume-low";
+	if(icon_number <= 6)
+		return "audio-volume-medium";
+	return "audio-volume-high";
+}
+
+static void status_icon_cache_clear()
+{
+	int i;
+	for(i = 0; i < ICON_COUNT; i++) {
+		if(m_icon_cache.pixbufs[i]) {
+			g_object_unref(m_icon_cache.pixbufs[i]);
+			m_icon_cache.pixbufs[i] = NULL;
+		}
+	}
+}
+
+static GdkPixbuf *status_icon_render(int icon_number, gint size)
+{
+	if(config_get_use_gtk_theme()) {
+		// Check if we are supposed to use the *-panel variant of an icon.
+		// Note that this only makes sense if we're using the default GTK
+		// icon theme as the icons that ship with volumeicon don't have
+		// panel-specific versions.
+		GtkIconTheme *icon_theme = gtk_icon_theme_get_default();
+		const gchar *icon_name = status_icon_get_name(icon_number);
+		GdkPixbuf *pixbuf = NULL;
+		if(config_get_use_panel_specific_icons()) {
+			gchar *panel_icon_name = g_strdup_printf("%s-panel", icon_name);
+			pixbuf = gtk_icon_theme_load_icon(icon_theme, panel_icon_name,
+			                                  size, GTK_ICON_LOOKUP_FORCE_SIZE,
+			                                  NULL);
+			g_free(panel_icon_name);
+		}
+		if(pixbuf == NULL) {
+			pixbuf = gtk_icon_theme_load_icon(
+			    icon_theme, icon_name, size, GTK_ICON_LOOKUP_FORCE_SIZE, NULL);
+		}
+		return pixbuf;
+	}
+
+	GdkPixbuf *icon = volume_icon_get_icon(icon_number);
+	if(icon == NULL)
+		return NULL;
+	int width = gdk_pixbuf_get_width(icon);
+	int height = gdk_pixbuf_get_height(icon);
+	if(height == size)
+		return icon;
+
+	GdkPixbuf *scaled = gdk_pixbuf_scale_simple(
+	    icon, MAX(1, width * size / height), size, GDK_INTERP_BILINEAR);
+	g_object_unref(icon);
+	return scaled;
+}
+
+// Returns the image for icon_number at the current panel size, NULL if the
+// theme doesn't have it.
+static GdkPixbuf *status_icon_cache_lookup(int icon_number)
+{
+	gint size = gtk_status_icon_get_size(m_status_icon);
+	if(size <= 0)
+		size = ICON_DEFAULT_SIZE;
+	if(size != m_icon_cache.size) {
+		status_icon_cache_clear();
+		m_icon_cache.size = size;
+	}
+
+	GdkPixbuf **pixbuf = &m_icon_cache.pixbufs[icon_number - 1];
+	if(*pixbuf == NULL)
+		*pixbuf = status_icon_render(icon_number, size);
+	return *pixbuf;
+}
+
+static GdkPixbuf *level_icon_lookup(int volume, gboolean mute)
+{
+	gint size = gtk_status_icon_get_size(m_status_icon);
+	if(size <= 0)
+		size = ICON_DEFAULT_SIZE;
+	// A boost above 100% shows as a full bar
+	volume = MIN(volume, 100);
+	gpointer key =
+	    GUINT_TO_POINTER(((guint)size << 8 | (guint)volume) << 1 | mute);
+
+	if(m_level_cache.pixbufs == NULL) {
+		m_level_cache.pixbufs = g_hash_table_new_full(
+		    g_direct_hash, g_direct_equal, NULL, g_object_unref);
+	}
+	GdkPixbuf *pixbuf = g_hash_table_lookup(m_level_cache.pixbufs, key);
+	if(pixbuf) {
+		g_queue_remove(&m_level_cache.lru, key);
+		g_queue_push_head(&m_level_cache.lru, key);
+		return pixbuf;
+	}
+
+	pixbuf = level_icon_render(volume, mute, size);
+	if(pixbuf == NULL)
+		return NULL;
+	g_hash_table_insert(m_level_cache.pixbufs, key, pixbuf);
+	g_queue_push_head(&m_level_cache.lru, key);
+	if(g_queue_get_length(&m_level_cache.lru) > LEVEL_CACHE_SIZE) {
+		g_hash_table_remove(m_level_cache.pixbufs,
+		                    g_queue_pop_tail(&m_level_cache.lru));
+	}
+	return pixbuf;
+}
+
 // Use the ignore_cache parameter to force the status icon to be loaded
 // from file, for example after a theme change.
 static void status_icon_update(gboolean mute, gboolean ignore_cache)
 {
 	static int volume_cache = -1;
 	static int icon_cache = -1;
-	int volume = backend_get_volume();
+	static int level_cache = -1;
+	int volume = m_volume;
+	gboolean use_level_theme = config_get_use_level_theme();
+
+	if(ignore_cache)
+		status_icon_cache_clear();
 
 	int icon_number = status_icon_get_number(volume, mute);
 	if(icon_number != icon_cache || ignore_cache) {
-		const gchar *icon_name;
-
-		if(icon_number == 1)
-			icon_name = "audio-volume-muted";
-		else if(icon_number <= 3)
-			icon_name = "audio-volume-low";
-		else if(icon_number <= 6)
-			icon_name = "audio-volume-medium";
-		else
-			icon_name = "audio-volume-high";
-
-		if(config_get_use_gtk_theme()) {
-			// Check if we are supposed to use the *-panel variant of an icon.
-			// Note that this only makes sense if we're using the default GTK
-			// icon theme as the icons that ship with volumeicon don't have
-			// panel-specific versions.
-			GtkIconTheme *icon_theme = gtk_icon_theme_get_default();
-			gchar *panel_icon_name = g_strdup_printf("%s-panel", icon_name);
-			if(config_get_use_panel_specific_icons() &&
-			   gtk_icon_theme_has_icon(icon_theme, panel_icon_name)) {
-				gtk_status_icon_set_from_icon_name(m_status_icon,
-				                                   panel_icon_name);
-			}
-			else {
-				gtk_status_icon_set_from_icon_name(m_status_icon, icon_name);
-			}
-			g_free(panel_icon_name);
-		}
-		else {
-			gtk_status_icon_set_from_pixbuf(m_status_icon,
-			                                m_icons[icon_number - 1]);
-		}
+		const gchar *icon_name = status_icon_get_name(icon_number);
+		GdkPixbuf *pixbuf =
+		    use_level_theme ? NULL : status_icon_cache_lookup(icon_number);
+		if(pixbuf)
+			gtk_status_icon_set_from_pixbuf(m_status_icon, pixbuf);
+		else if(!use_level_theme)
+			gtk_status_icon_set_from_icon_name(m_status_icon, icon_name);
 
 // Always use the current GTK icon theme for notifications.
 #ifdef COMPILEWITH_NOTIFY
@@ -1000,9 +1331,18 @@ static void status_icon_update(gboolean mute, gboolean ignore_cache)
 		icon_cache = icon_number;
 	}
 
-	if((volume != volume_cache || ignore_cache) && backend_get_channel()) {
+	// Only redrawn when the volume or mute really changed
+	int level = volume << 1 | (mute ? 1 : 0);
+	if(use_level_theme && (level != level_cache || ignore_cache)) {
+		GdkPixbuf *pixbuf = level_icon_lookup(volume, mute);
+		if(pixbuf)
+			gtk_status_icon_set_from_pixbuf(m_status_icon, pixbuf);
+		level_cache = level;
+	}
+
+	if((volume != volume_cache || ignore_cache) && m_backend->get_channel()) {
 		gchar buffer[32];
-		g_sprintf(buffer, "%s: %d%%", backend_get_channel(), volume);
+		g_sprintf(buffer, "%s: %d%%", m_backend->get_channel(), volume);
 		gtk_status_icon_set_tooltip_text(m_status_icon, buffer);
 
 #ifdef COMPILEWITH_NOTIFY
@@ -1020,6 +1360,13 @@ static void icon_theme_on_changed(GtkIconTheme *icon_theme, gpointer user_data)
 	status_icon_update(m_mute, TRUE);
 }
 
+static gboolean status_icon_on_size_changed(GtkStatusIcon *status_icon,
+                                            gint size, gpointer user_data)
+{
+	status_icon_update(m_mute, TRUE);
+	return TRUE;
+}
+
 static void status_icon_setup(gboolean mute)
 {
 	GtkIconTheme *icon_theme = gtk_icon_theme_get_default();
@@ -1034,38 +1381,80 @@ static void status_icon_setup(gboolean mute)
 	                 G_CALLBACK(status_icon_on_scroll_event), NULL);
 	g_signal_connect(G_OBJECT(m_status_icon), "popup-menu",
 	                 G_CALLBACK(status_icon_on_popup_menu), NULL);
+	g_signal_connect(G_OBJECT(m_status_icon), "size-changed",
+	                 G_CALLBACK(status_icon_on_size_changed), NULL);
 	status_icon_update(mute, FALSE);
 	gtk_status_icon_set_visible(m_status_icon, TRUE);
 }
 
 static void volume_icon_on_volume_changed(int volume, gboolean mute)
 {
+	// The device picked in the preferences has finished its setup
+	if(m_channel_pending && m_backend->get_channel()) {
+		m_channel_pending = FALSE;
+		config_set_channel(m_backend->get_channel());
+		if(gui)
+			preferences_reload_channels();
+	}
+
+	// Our pending write is going to override this anyway, and there's
+	// nothing to update if we already show this state.
+	if(m_write.pending || (m_volume == volume && m_mute == mute))
+		return;
+
 	m_mute = mute;
 	m_volume = clamp_volume(volume);
 	status_icon_update(m_mute, FALSE);
 	scale_update();
 }
 
-static void volume_icon_load_icons()
+static void volume_icon_on_devices_changed()
 {
-	if(config_get_use_gtk_theme())
+	if(gui == NULL)
 		return;
 
-	static gboolean icons_loaded = FALSE;
-	const gchar *theme = config_get_theme();
-	int i;
+	// The selected device and channel stay the same, so there's nothing to
+	// set up
+	g_signal_handlers_block_by_func(gui->device_combobox,
+	                                preferences_device_combobox_changed, NULL);
+	populate_device_model_and_combobox(gui);
+	g_signal_handlers_unblock_by_func(
+	    gui->device_combobox, preferences_device_combobox_changed, NULL);
+	preferences_reload_channels();
+}
 
-	for(i = 0; i < ICON_COUNT; i++) {
-		gchar *icon_path =
-		    g_strdup_printf(ICONS_DIR "/%s/%d.png", theme, i + 1);
-		if(icons_loaded && m_icons[i])
-			g_object_unref(m_icons[i]);
-		m_icons[i] = gdk_pixbuf_new_from_file(icon_path, NULL);
-		if(!m_icons[i])
-			g_message("Failed to load '%s'", icon_path);
+// Icons of a new theme might be there even if those of the old one weren't
+static void volume_icon_reset_icons() { m_icons_failed = 0; }
+
+static GdkPixbuf *volume_icon_decode_icon(int i)
+{
+	// Bundled themes come from the binary, others from ICONS_DIR
+	const gchar *theme = config_get_theme();
+	gchar *icon_path =
+	    g_strdup_printf(ICONS_RESOURCE "/%s/%d.png", theme, i + 1);
+	GdkPixbuf *icon = gdk_pixbuf_new_from_resource(icon_path, NULL);
+	if(!icon) {
 		g_free(icon_path);
+		icon_path = g_strdup_printf(ICONS_DIR "/%s/%d.png", theme, i + 1);
+		icon = gdk_pixbuf_new_from_file(icon_path, NULL);
 	}
-	icons_loaded = TRUE;
+	if(!icon)
+		g_message("Failed to load '%s'", icon_path);
+	g_free(icon_path);
+	return icon;
+}
+
+// Decodes the icon of the theme for icon_number, NULL if it's missing
+static GdkPixbuf *volume_icon_get_icon(int icon_number)
+{
+	int i = icon_number - 1;
+	if(m_icons_failed & (1 << i))
+		return NULL;
+
+	GdkPixbuf *icon = volume_icon_decode_icon(i);
+	if(!icon)
+		m_icons_failed |= 1 << i;
+	return icon;
 }
 
 static void scale_update()
@@ -1082,10 +1471,12 @@ static void scale_value_changed(GtkRange *range, gpointer user_data)
 		return;
 	double value = gtk_range_get_value(range);
 	m_volume = clamp_volume((int)value);
-	backend_set_volume(m_volume);
 	if(m_mute) {
 		m_mute = FALSE;
-		backend_set_mute(m_mute);
+		volume_write(TRUE);
+	}
+	else {
+		volume_write(FALSE);
 	}
 	status_icon_update(m_mute, FALSE);
 	scale_update();
@@ -1254,6 +1645,23 @@ static void scale_setup()
 	                 G_CALLBACK(scale_value_changed), NULL);
 	g_signal_connect(G_OBJECT(m_scale_window), "composited-changed",
 	                 G_CALLBACK(on_composited_changed), NULL);
+
+	gtk_widget_add_events(m_scale_window,
+	                      GDK_ENTER_NOTIFY_MASK | GDK_LEAVE_NOTIFY_MASK |
+	                          GDK_POINTER_MOTION_MASK | GDK_BUTTON_PRESS_MASK |
+	                          GDK_STRUCTURE_MASK);
+	g_signal_connect(G_OBJECT(m_scale_window), "enter-notify-event",
+	                 G_CALLBACK(scale_on_enter), NULL);
+	g_signal_connect(G_OBJECT(m_scale_window), "leave-notify-event",
+	                 G_CALLBACK(scale_on_leave), NULL);
+	g_signal_connect(G_OBJECT(m_scale_window), "motion-notify-event",
+	                 G_CALLBACK(scale_on_motion), NULL);
+	g_signal_connect(G_OBJECT(m_scale_window), "button-press-event",
+	                 G_CALLBACK(scale_on_button_press), NULL);
+	g_signal_connect(G_OBJECT(m_scale_window), "map-event",
+	                 G_CALLBACK(scale_on_map), NULL);
+	g_signal_connect(G_OBJECT(m_scale_window), "hide",
+	                 G_CALLBACK(scale_on_hide), NULL);
 }
 
 static void hotkey_handle(const char *key, void *user_data)
@@ -1261,38 +1669,85 @@ static void hotkey_handle(const char *key, void *user_data)
 	enum HOTKEY hotkey = (enum HOTKEY)user_data;
 	if(hotkey == MUTE) {
 		m_mute = !m_mute;
-		backend_set_volume(m_volume);
-		backend_set_mute(m_mute);
+		volume_write(TRUE);
 		status_icon_update(m_mute, FALSE);
 	}
 	else {
 		int step = config_get_stepsize();
-		m_volume = clamp_volume(m_volume + (hotkey == UP ? step : -step));
-		backend_set_volume(m_volume);
+		m_volume = step_volume(hotkey == UP ? step : -step);
+		volume_write(FALSE);
 		status_icon_update(m_mute, FALSE);
 	}
 	scale_update();
 	notification_show();
 }
 
-static gboolean retry_setup_cb(gpointer data)
+static gboolean hotplug_setup_cb(gpointer data)
 {
-	if(m_backend_is_setup) {
+	m_hotplug_timeout_id = 0;
+
+	// Only redo a working setup if a device went away, it might have been
+	// the one we're using.
+	if(m_backend_is_setup && !m_hotplug_removed)
 		return FALSE;
-	}
+	m_hotplug_removed = FALSE;
+
+	volume_write_flush();
 	m_backend_is_setup =
-	    backend_setup(m_commandline_device_name ? m_commandline_device_name :
+	    m_backend->setup(m_commandline_device_name ? m_commandline_device_name :
 	                                              config_get_card(),
 	                  config_get_channel(), volume_icon_on_volume_changed);
-	if(m_backend_is_setup) {
-		m_volume = clamp_volume(backend_get_volume());
-		m_mute = backend_get_mute();
-		status_icon_update(m_mute, FALSE);
-		return FALSE;
+	m_volume = clamp_volume(m_backend->get_volume());
+	m_mute = m_backend->get_mute();
+	status_icon_update(m_mute, FALSE);
+	scale_update();
+	return FALSE;
+}
+
+static void hotplug_on_changed(GFileMonitor *monitor, GFile *file,
+                               GFile *other_file, GFileMonitorEvent event_type,
+                               gpointer user_data)
+{
+	gchar *name = g_file_get_basename(file);
+	gboolean matches = g_str_has_prefix(name, m_backend->hotplug_prefix);
+	g_free(name);
+	if(!matches)
+		return;
+
+	switch(event_type) {
+	case G_FILE_MONITOR_EVENT_DELETED:
+		m_hotplug_removed = TRUE;
+		break;
+	case G_FILE_MONITOR_EVENT_CREATED:
+	case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+		break;
+	default:
+		return;
 	}
-	else {
-		return TRUE;
+
+	// Device nodes come and go in bursts, give them a moment to settle
+	if(m_hotplug_timeout_id)
+		g_source_remove(m_hotplug_timeout_id);
+	m_hotplug_timeout_id =
+	    g_timeout_add(HOTPLUG_SETTLE_DELAY, hotplug_setup_cb, NULL);
+}
+
+static void hotplug_setup()
+{
+	if(m_backend->hotplug_dir == NULL)
+		return;
+
+	GFile *dir = g_file_new_for_path(m_backend->hotplug_dir);
+	m_hotplug_monitor =
+	    g_file_monitor_directory(dir, G_FILE_MONITOR_NONE, NULL, NULL);
+	g_object_unref(dir);
+	if(m_hotplug_monitor == NULL) {
+		g_fprintf(stderr, "Failed to watch %s for devices\n",
+		          m_backend->hotplug_dir);
+		return;
 	}
+	g_signal_connect(G_OBJECT(m_hotplug_monitor), "changed",
+	                 G_CALLBACK(hotplug_on_changed), NULL);
 }
 
 //##############################################################################
@@ -1314,6 +1769,8 @@ int main(int argc, char *argv[])
 	     "name"},
 	    {"device", 'd', 0, G_OPTION_ARG_STRING, &m_commandline_device_name,
 	     N_("Mixer device name"), "name"},
+	    {"backend", 'b', 0, G_OPTION_ARG_STRING, &m_commandline_backend_name,
+	     N_("Sound backend to use"), "name"},
 	    {"version", 'v', 0, G_OPTION_ARG_NONE, &print_version,
 	     N_("Output version number and exit"), NULL},
 	    {NULL}};
@@ -1379,43 +1836,36 @@ int main(int argc, char *argv[])
 
 	gtk_container_add(GTK_CONTAINER(m_popup_window), GTK_WIDGET(hbox));
 
-// Setup backend
-#ifdef COMPILEWITH_OSS
-	backend_setup = &oss_setup;
-	backend_set_channel = &oss_set_channel;
-	backend_set_volume = &oss_set_volume;
-	backend_get_volume = &oss_get_volume;
-	backend_set_mute = &oss_set_mute;
-	backend_get_mute = &oss_get_mute;
-	backend_get_channel = &oss_get_channel;
-	backend_get_channel_names = &oss_get_channel_names;
-#else
-	backend_setup = &asound_setup;
-	backend_set_channel = &asound_set_channel;
-	backend_set_volume = &asound_set_volume;
-	backend_get_volume = &asound_get_volume;
-	backend_get_mute = &asound_get_mute;
-	backend_set_mute = &asound_set_mute;
-	backend_get_channel = &asound_get_channel;
-	backend_get_channel_names = &asound_get_channel_names;
-	backend_get_device = &asound_get_device;
-	backend_get_device_names = &asound_get_device_names;
-#endif
-
 	// Setup
 	config_initialize(config_name);
+
+	// Pick the backend asked for, or the first one that works here
+	const gchar *backend_name = m_commandline_backend_name ?
+	                                m_commandline_backend_name :
+	                                config_get_backend();
+	m_backend = backend_name ? backend_find(backend_name) : backend_probe();
+	if(m_backend == NULL) {
+		gchar *names = backend_get_names();
+		if(backend_name)
+			g_printerr(_("Unknown backend %s, available backends are: %s\n"),
+			           backend_name, names);
+		else
+			g_printerr(_("Volume Icon was built without a sound backend\n"));
+		g_free(names);
+		return EXIT_FAILURE;
+	}
 	m_backend_is_setup =
-	    backend_setup(m_commandline_device_name ? m_commandline_device_name :
+	    m_backend->setup(m_commandline_device_name ? m_commandline_device_name :
 	                                              config_get_card(),
 	                  config_get_channel(), volume_icon_on_volume_changed);
-	if(!m_backend_is_setup) {
-		g_timeout_add(SETUP_RETRY_INTERVAL, retry_setup_cb, NULL);
-	}
-	else {
-		m_volume = clamp_volume(backend_get_volume());
-		m_mute = backend_get_mute();
+	if(m_backend_is_setup) {
+		m_volume = clamp_volume(m_backend->get_volume());
+		m_mute = m_backend->get_mute();
 	}
-	volume_icon_load_icons();
+	if(m_backend->watch_devices)
+		m_backend->watch_devices(volume_icon_on_devices_changed);
+	hotplug_setup();
+	volume_icon_reset_icons();
 	status_icon_setup(m_mute);
 	scale_setup();
 	gint notification_type = config_get_notification_type();
@@ -1434,14 +1884,21 @@ int main(int argc, char *argv[])
 	   !keybinder_bind(config_get_hotkey_mute(), hotkey_handle, (void *)MUTE))
 		g_fprintf(stderr, "Failed to bind %s\n", config_get_hotkey_mute());
 
+	g_unix_signal_add(SIGUSR1, diagnostics_dump, NULL);
+
 	// Main Loop
 	gtk_main();
+	volume_write_flush();
+	if(m_backend->close)
+		m_backend->close();
 
 #ifdef COMPILEWITH_NOTIFY
 	g_object_unref(G_OBJECT(m_notification));
 	notify_uninit();
 #endif
 	gtk_widget_destroy(GTK_WIDGET(m_popup_window));
+	if(m_hotplug_monitor)
+		g_object_unref(m_hotplug_monitor);
 
 	return EXIT_SUCCESS;
 }